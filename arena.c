@@ -0,0 +1,107 @@
+#include "arena.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include <nng/nng.h>
+
+struct arena_chunk {
+    struct arena_chunk *next;
+    size_t              size; // of data[]
+    size_t              used;
+    max_align_t         data[];
+};
+
+void arena_init(struct arena *a, size_t chunk_size)
+{
+    memset(a, 0, sizeof(*a));
+    a->chunk_size = chunk_size;
+}
+
+void arena_fini(struct arena *a)
+{
+    struct arena_chunk *c;
+
+    while ((c = a->head) != NULL) {
+        a->head = c->next;
+        nng_free(c, sizeof(*c) + c->size);
+    }
+    a->reserved = 0;
+    a->used     = 0;
+}
+
+static struct arena_chunk *chunk_new(struct arena *a, size_t size)
+{
+    struct arena_chunk *c;
+
+    if ((c = nng_alloc(sizeof(*c) + size)) == NULL) {
+        return (NULL);
+    }
+    c->size = size;
+    c->used = 0;
+    a->reserved += sizeof(*c) + size;
+    return (c);
+}
+
+// Returns zeroed memory aligned to align (a power of two), or NULL when
+// out of memory. Requests that would waste much of a chunk get one of
+// their own, linked behind the current chunk so it stays in use.
+void *arena_alloc(struct arena *a, size_t size, size_t align)
+{
+    struct arena_chunk *c = a->head;
+    uintptr_t           p;
+    size_t              pad;
+
+    if (c != NULL) {
+        p   = (uintptr_t) c->data + c->used;
+        pad = (align - (p & (align - 1))) & (align - 1);
+        if (c->used + pad + size <= c->size) {
+            c->used += pad + size;
+            a->used += pad + size;
+            memset((void *) (p + pad), 0, size);
+            return ((void *) (p + pad));
+        }
+    }
+
+    if (size + align > a->chunk_size / 4) {
+        struct arena_chunk *big;
+        if ((big = chunk_new(a, size + align)) == NULL) {
+            return (NULL);
+        }
+        if (c != NULL) {
+            big->next = c->next;
+            c->next   = big;
+        } else {
+            big->next = NULL;
+            a->head   = big;
+        }
+        c = big;
+    } else {
+        if ((c = chunk_new(a, a->chunk_size)) == NULL) {
+            return (NULL);
+        }
+        c->next = a->head;
+        a->head = c;
+    }
+    p   = (uintptr_t) c->data;
+    pad = (align - (p & (align - 1))) & (align - 1);
+    c->used = pad + size;
+    a->used += pad + size;
+    memset((void *) (p + pad), 0, size);
+    return ((void *) (p + pad));
+}
+
+void *arena_memdup(struct arena *a, const void *data, size_t len)
+{
+    void *p;
+
+    if ((p = arena_alloc(a, len, 1)) != NULL) {
+        memcpy(p, data, len);
+    }
+    return (p);
+}
+
+char *arena_strdup(struct arena *a, const char *s)
+{
+    return (arena_memdup(a, s, strlen(s) + 1));
+}
@@ -0,0 +1,26 @@
+#ifndef MQTT_BENCH_ARENA_H
+#define MQTT_BENCH_ARENA_H
+
+#include <stddef.h>
+
+// A bump allocator for state that lives as long as the run: options,
+// topics and the per-connection slabs. Nothing is freed individually;
+// arena_fini() releases it all at once.
+struct arena_chunk;
+
+struct arena {
+    struct arena_chunk *head;
+    size_t              chunk_size;
+    size_t              reserved; // bytes obtained from nng_alloc
+    size_t              used;     // bytes handed out, including padding
+};
+
+#define ARENA_CACHE_LINE 64
+
+void  arena_init(struct arena *a, size_t chunk_size);
+void  arena_fini(struct arena *a);
+void *arena_alloc(struct arena *a, size_t size, size_t align);
+void *arena_memdup(struct arena *a, const void *data, size_t len);
+char *arena_strdup(struct arena *a, const char *s);
+
+#endif
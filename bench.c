@@ -3,12 +3,12 @@
 
 #include <ctype.h>
 #include <errno.h>
-#include <stdarg.h>
 #include <stdatomic.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <nng/mqtt/mqtt_client.h>
 #include <nng/nng.h>
@@ -21,6 +21,23 @@ static int init_dialer_tls(nng_dialer d, const char *cacert, const char *cert,
                            const char *key, const char *pass);
 #endif
 
+#ifdef NNG_SUPP_QUIC
+#include <nng/mqtt/mqtt_quic.h>
+#endif
+
+#include "arena.h"
+#include "checksum.h"
+#include "consumer.h"
+#include "corpus.h"
+#include "credentials.h"
+#include "fairness.h"
+#include "hdr_histogram.h"
+#include "launcher.h"
+#include "message.h"
+#include "profile.h"
+#include "pub_template.h"
+#include "results.h"
+
 static void loadfile(const char *path, void **datap, size_t *lenp);
 static void client_stop(int argc, char **argv);
 
@@ -34,14 +51,43 @@ struct topic {
     char *        val;
 };
 
+// The url scheme picks the transport. QUIC sockets are opened and
+// connected through their own API and only exist in NanoNNG builds with
+// QUIC support.
+enum transport {
+    TRANSPORT_TCP,
+    TRANSPORT_TLS,
+    TRANSPORT_WS,
+    TRANSPORT_WSS,
+    TRANSPORT_QUIC,
+};
+
+static const char *transport_schemes[] = {
+    [TRANSPORT_TCP]  = "mqtt-tcp://",
+    [TRANSPORT_TLS]  = "tls+mqtt-tcp://",
+    [TRANSPORT_WS]   = "ws://",
+    [TRANSPORT_WSS]  = "wss://",
+    [TRANSPORT_QUIC] = "mqtt-quic://",
+};
+
 struct client_opts {
     enum client_type type;
     bool             verbose;
+    size_t           conns;
     size_t           parallel;
+    size_t           pipeline;
+    bool             coalesce;
     atomic_ulong     msg_count;
     size_t           interval;
+    uint64_t         rate;
+    bool             find_max;
+    uint64_t         max_rate;
+    uint32_t         step_time;
+    uint32_t         slo_p99;
+    double           slo_loss;
     uint8_t          version;
     char *           url;
+    enum transport   transport;
     struct topic *   topic;
     size_t           topic_count;
     uint8_t          qos;
@@ -66,12 +112,38 @@ struct client_opts {
     char *           key;
     size_t           key_len;
     char *           keypass;
+    char *           hdr_log;
+    bool             stamp;
+    bool             checksum;
+    uint32_t         topic_vary;
+    struct consumer_cfg consumer;
+    uint32_t         pause_run;
+    uint32_t         pause_len;
+    uint32_t         repeat;
+    uint32_t         duration;
+    char *           json;
+    bool             profile;
+    uint32_t         worst;
+    struct credentials creds;
+    struct launch_cfg launch;
+    uint32_t         reconn_min;
+    uint32_t         reconn_max;
+    char *           corpus_file;
+    enum corpus_format corpus_format;
+    struct corpus    corpus;
+    struct connect_cfg connect;
 };
 
 typedef struct client_opts client_opts;
 
 client_opts *opts = NULL;
 
+// Options, topics and the per-connection slabs, released together by
+// client_stop().
+static struct arena arena;
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
 enum options {
     OPT_HELP = 1,
     OPT_VERBOSE,
@@ -101,6 +173,38 @@ enum options {
     OPT_KEYPASS,
     OPT_MSG,
     OPT_FILE,
+    OPT_HDR_LOG,
+    OPT_PIPELINE,
+    OPT_COALESCE,
+    OPT_STAMP,
+    OPT_TOPIC_VARY,
+    OPT_CONNS,
+    OPT_BUSY,
+    OPT_HASH,
+    OPT_QUEUE,
+    OPT_CONSUMERS,
+    OPT_QUEUE_DROP,
+    OPT_PAUSE,
+    OPT_CHECKSUM,
+    OPT_RATE,
+    OPT_FIND_MAX,
+    OPT_MAX_RATE,
+    OPT_STEP_TIME,
+    OPT_SLO_P99,
+    OPT_SLO_LOSS,
+    OPT_REPEAT,
+    OPT_DURATION,
+    OPT_JSON,
+    OPT_PROFILE,
+    OPT_WORST,
+    OPT_CREDENTIALS,
+    OPT_CONN_RATE,
+    OPT_CONN_BATCH,
+    OPT_CONN_JITTER,
+    OPT_LAUNCH_THREADS,
+    OPT_RECONNECT,
+    OPT_CORPUS,
+    OPT_CORPUS_FORMAT,
 };
 
 static nng_optspec cmd_opts[] = {
@@ -115,6 +219,35 @@ static nng_optspec cmd_opts[] = {
       .o_val   = OPT_INTERVAL,
       .o_arg   = true },
     { .o_name = "count", .o_short = 'C', .o_val = OPT_MSGCOUNT, .o_arg = true },
+    { .o_name = "pipeline", .o_val = OPT_PIPELINE, .o_arg = true },
+    { .o_name = "coalesce", .o_val = OPT_COALESCE },
+    { .o_name = "conns", .o_val = OPT_CONNS, .o_arg = true },
+    { .o_name = "busy", .o_val = OPT_BUSY, .o_arg = true },
+    { .o_name = "hash", .o_val = OPT_HASH },
+    { .o_name = "queue", .o_val = OPT_QUEUE, .o_arg = true },
+    { .o_name = "consumers", .o_val = OPT_CONSUMERS, .o_arg = true },
+    { .o_name = "queue-drop", .o_val = OPT_QUEUE_DROP },
+    { .o_name = "pause", .o_val = OPT_PAUSE, .o_arg = true },
+    { .o_name = "checksum", .o_val = OPT_CHECKSUM },
+    { .o_name = "rate", .o_val = OPT_RATE, .o_arg = true },
+    { .o_name = "find-max", .o_val = OPT_FIND_MAX },
+    { .o_name = "max-rate", .o_val = OPT_MAX_RATE, .o_arg = true },
+    { .o_name = "step-time", .o_val = OPT_STEP_TIME, .o_arg = true },
+    { .o_name = "slo-p99", .o_val = OPT_SLO_P99, .o_arg = true },
+    { .o_name = "slo-loss", .o_val = OPT_SLO_LOSS, .o_arg = true },
+    { .o_name = "repeat", .o_val = OPT_REPEAT, .o_arg = true },
+    { .o_name = "duration", .o_val = OPT_DURATION, .o_arg = true },
+    { .o_name = "json", .o_val = OPT_JSON, .o_arg = true },
+    { .o_name = "profile", .o_val = OPT_PROFILE },
+    { .o_name = "worst", .o_val = OPT_WORST, .o_arg = true },
+    { .o_name = "credentials", .o_val = OPT_CREDENTIALS, .o_arg = true },
+    { .o_name = "conn-rate", .o_val = OPT_CONN_RATE, .o_arg = true },
+    { .o_name = "conn-batch", .o_val = OPT_CONN_BATCH, .o_arg = true },
+    { .o_name = "conn-jitter", .o_val = OPT_CONN_JITTER, .o_arg = true },
+    { .o_name = "launch-threads", .o_val = OPT_LAUNCH_THREADS, .o_arg = true },
+    { .o_name = "reconnect", .o_val = OPT_RECONNECT, .o_arg = true },
+    { .o_name = "corpus", .o_val = OPT_CORPUS, .o_arg = true },
+    { .o_name = "corpus-format", .o_val = OPT_CORPUS_FORMAT, .o_arg = true },
     { .o_name = "version", .o_short = 'V', .o_val = OPT_VERSION },
     { .o_name = "url", .o_val = OPT_URL, .o_arg = true },
     { .o_name = "topic", .o_short = 't', .o_val = OPT_TOPIC, .o_arg = true },
@@ -151,37 +284,115 @@ static nng_optspec cmd_opts[] = {
 
     { .o_name = "msg", .o_short = 'm', .o_val = OPT_MSG, .o_arg = true },
     { .o_name = "file", .o_short = 'f', .o_val = OPT_FILE, .o_arg = true },
+    { .o_name = "hdr-log", .o_val = OPT_HDR_LOG, .o_arg = true },
+    { .o_name = "stamp", .o_val = OPT_STAMP },
+    { .o_name = "topic-vary", .o_val = OPT_TOPIC_VARY, .o_arg = true },
 
     { .o_name = NULL, .o_val = 0 },
 };
 
+// A lane is one logical publisher. With --pipeline each lane drives
+// several works, and they take turns claiming the next due time from the
+// lane's schedule so that up to <depth> sends are in flight at once.
+// Each takes a cache line of its own, like a work.
+struct lane {
+    _Alignas(ARENA_CACHE_LINE) atomic_ullong next_due; // ns
+    atomic_ullong woken;    // last wake-up from a pacing timer (us)
+};
+
+// Works sit in one slab, a cache line or more each, so that callbacks
+// running on different threads do not share lines.
 struct work {
-    enum { INIT, RECV, RECV_WAIT, SEND_WAIT, SEND } state;
+    _Alignas(ARENA_CACHE_LINE) enum {
+        INIT,
+        RECV,
+        RECV_WAIT,
+        RECV_FULL,
+        RECV_PAUSE,
+        SEND_WAIT,
+        SEND,
+        DONE
+    } state;
     nng_aio *    aio;
     nng_msg *    msg;
     nng_ctx      ctx;
     client_opts *opts;
+    struct lane *lane;
+    struct conn_stats *cstats;
+    uint64_t     intended; // scheduled start of the in-flight send (us)
+    uint32_t     id;
+    uint64_t     seq;
+    struct pub_template tmpl;
 };
 
 static atomic_bool exit_signal = false;
-static atomic_long send_count  = 0;
 static atomic_long recv_count  = 0;
 
-void fatal(const char *msg, ...)
-{
-    va_list ap;
-    va_start(ap, msg);
-    vfprintf(stderr, msg, ap);
-    va_end(ap);
-    fprintf(stderr, "\n");
-    exit(1);
-}
+// Set by client_teardown(): callbacks from then on only release what
+// they hold.
+static atomic_bool stopping = false;
+
+// Outcome of --checksum verification on the subscriber.
+static atomic_long recv_verified  = 0;
+static atomic_long recv_corrupt   = 0;
+static atomic_long recv_truncated = 0;
+
+// One entry per connection, see fairness.h.
+static struct conn_stats *conn_stats;
+
+// Client CPU accounting for --profile, see profile.h.
+static struct profile *profile;
+
+// Simulated processing of received messages, see consumer.h.
+static struct consumer *consumer;
+static nng_time         recv_start;
+
+// With --count every send is claimed from send_budget before it is
+// issued, so exactly msg_count messages go out. A send is counted once
+// it completes, successfully (send_done) or not (send_errors).
+static atomic_long send_budget   = 0;
+static atomic_long send_finished = 0;
+static atomic_long send_done     = 0;
+static atomic_long send_errors   = 0;
+
+// Time between sends on one lane, from --interval or --rate; 0 sends as
+// fast as completions allow.
+static atomic_ullong interval_ns = 0;
+
+// Publishing works that have not retired yet; a run is over once they
+// all have.
+static atomic_long pub_active = 0;
+
+// First send or receive, and last completion (us), for wall-clock rates.
+static atomic_ullong first_us = 0;
+static atomic_ullong last_us  = 0;
+
+// Latency in microseconds, measured from the time a message was due to
+// be sent rather than when it actually went out, so that stalls in the
+// broker are not hidden by the generator falling behind its schedule.
+static struct hdr_histogram *latency;
+
+// Converts bench_clock_us() readings to wall-clock time for stamps, which
+// may be read back by a subscriber in another process.
+static int64_t wall_offset_us;
+
+// A send that has not completed by then, say on a stalled broker or a
+// lost connection, fails and counts as an error, so that the end of a
+// run never waits on the broker for longer.
+#define SEND_TIMEOUT_MS 10000
 
 static void nng_fatal(const char *msg, int rv)
 {
     fatal("%s:%s", msg, nng_strerror(rv));
 }
 
+static double wall_clock(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
 static void help(enum client_type type)
 {
     switch (type) {
@@ -204,7 +415,9 @@ static void help(enum client_type type)
 
     printf("<addr> must be one or more of:\n");
     printf("  --url <url>                      The url for mqtt broker "
-           "('mqtt-tcp://host:port' or 'tls+mqtt-tcp://host:port') \n");
+           "('mqtt-tcp://host:port', 'tls+mqtt-tcp://host:port', \n");
+    printf("                                   'ws://host:port/mqtt', "
+           "'wss://host:port/mqtt' or 'mqtt-quic://host:port') \n");
     printf("                                   [default: "
            "mqtt-tcp://127.0.0.1:1883]\n");
 
@@ -219,11 +432,26 @@ static void help(enum client_type type)
            "the client [default: 4]\n");
     printf("  -n, --parallel             	   The number of parallel for "
            "client [default: 1]\n");
+    printf("  --conns <num>                    The number of connections, "
+           "each with <parallel> contexts [default: 1]\n");
+    printf("  --conn-rate <num>                Dial at most <num> "
+           "connections per second [default: unlimited]\n");
+    printf("  --conn-batch <num>               Connections dialed together "
+           "under --conn-rate [default: 1]\n");
+    printf("  --conn-jitter <ms>               Random delay of up to <ms> "
+           "before each dial\n");
+    printf("  --launch-threads <num>           Threads setting up "
+           "connections [default: 4]\n");
+    printf("  --reconnect <min_ms>,<max_ms>    Backoff between redials, "
+           "doubling from min to max\n");
     printf("  -v, --verbose              	   Enable verbose mode\n");
     printf("  -u, --user <user>                The username for "
-           "authentication\n");
+           "authentication; %%i is replaced by the connection index\n");
     printf("  -p, --password <password>        The password for "
-           "authentication\n");
+           "authentication; %%i as for --user\n");
+    printf("  --credentials <file>             Take the username and "
+           "password of each connection from the lines of <file>, as "
+           "<user>:<password>\n");
     printf("  -k, --keepalive <keepalive>      A keep alive of the client "
            "(in seconds) [default: 60]\n");
     if (type == PUB) {
@@ -231,12 +459,67 @@ static void help(enum client_type type)
                "publish\n");
         printf("  -C, --count <num>                Max count of "
                "publishing "
-               "message [default: 1]\n");
+               "message [default: unlimited]\n");
         printf("  -i, --interval <ms>              Interval of "
                "publishing "
                "message (ms) [default: 0]\n");
+        printf("  --rate <msg/sec>                 Offered rate across all "
+               "clients, instead of --interval; each lane is\n");
+        printf("                                   paced with a 1ms timer, "
+               "late wake-ups do not count as latency\n");
+        printf("  --find-max                       Search for the highest "
+               "rate that meets the SLO, starting at --rate [default: "
+               "1000]\n");
+        printf("  --max-rate <msg/sec>             Upper bound of the "
+               "search [default: 1000000]\n");
+        printf("  --step-time <sec>                How long each rate is "
+               "held [default: 10]\n");
+        printf("  --slo-p99 <us>                   p99 latency the SLO "
+               "allows [default: 10000]\n");
+        printf("  --slo-loss <percent>             Share of offered "
+               "messages that may go unsent [default: 0.1]\n");
+        printf("  --pipeline <depth>               Outstanding sends per "
+               "parallel client [default: 1]\n");
+        printf("  --coalesce                       Disable TCP_NODELAY so "
+               "that pipelined PUBLISH packets share socket writes; "
+               "latency then includes Nagle delays\n");
+        printf("  --stamp                          Prefix the payload with a "
+               "sequence number and timestamp for end-to-end latency\n");
+        printf("  --topic-vary <num>               Append a fixed-width "
+               "suffix cycling through <num> values to the topic\n");
         printf("  -I, --identifier <identifier>    The client identifier "
-               "UTF-8 String (default randomly generated string)\n");
+               "UTF-8 String (default randomly generated string); %%i is "
+               "replaced by the connection index\n");
+    }
+    if (type == SUB) {
+        printf("  --busy <us>                      Spin for <us> on every "
+               "received message\n");
+        printf("  --hash                           Hash the payload of every "
+               "received message\n");
+        printf("  --queue <len>                    Process messages from a "
+               "bounded queue instead of the receive callback\n");
+        printf("  --consumers <num>                Threads draining the "
+               "queue [default: 1]\n");
+        printf("  --queue-drop                     Drop messages when the "
+               "queue is full instead of blocking receives\n");
+        printf("  --pause <run_ms>,<pause_ms>      Stop receiving for "
+               "<pause_ms> after every <run_ms>\n");
+    }
+    if (type == PUB || type == SUB) {
+        printf("  --checksum                       Append (pub) or verify "
+               "(sub) a CRC32C trailer on every payload\n");
+        printf("  --duration <sec>                 End each run after "
+               "<sec>\n");
+        printf("  --repeat <num>                   Measure <num> runs, each "
+               "ended by --duration or (-C, --count) [default: 1]\n");
+        printf("  --json <file>                    Write the results of "
+               "every run to <file> for '" APP_NAME " compare'\n");
+        printf("  --profile                        Report the CPU time and "
+               "cycles per message of the client, and flag runs it "
+               "saturated\n");
+        printf("  --worst <num>                    With --conns, list the "
+               "<num> connections that got the fewest messages "
+               "[default: 3]\n");
     }
     printf("  -q, --qos <qos>                  Quality of service for the "
            "corresponding topic [default: 0]\n");
@@ -258,11 +541,19 @@ static void help(enum client_type type)
     printf("      -E, --cert <file>            Certificate file path\n");
     printf("      --key <file>                 Private key file path\n");
     printf("      --keypass <key password>     Private key password\n");
+    printf("  --hdr-log <file>                 Write interval latency "
+           "histograms in HdrHistogram log format\n");
 
     if (type == PUB) {
         printf("\n<src> may be one of:\n");
         printf("  -m, --msg  <data>                \n");
         printf("  -f, --file <file>                \n");
+        printf("  --corpus <file>                  Publish the records of "
+               "<file> in turn, one per message\n");
+        printf("  --corpus-format <lines|len32>    One record per line, or "
+               "each preceded by\n");
+        printf("                                   its 4 byte big-endian "
+               "length [default: lines]\n");
     }
 }
 
@@ -290,31 +581,75 @@ static int intarg(const char *val, int maxv)
     return (v);
 }
 
-struct topic **addtopic(struct topic **endp, const char *s)
+static double floatarg(const char *val)
 {
-    struct topic *t;
+    char * end;
+    double v = strtod(val, &end);
 
-    if (((t = malloc(sizeof(*t))) == NULL) ||
-        ((t->val = malloc(strlen(s) + 1)) == NULL)) {
-        fatal("Out of memory.");
+    if (val[0] == '\0' || *end != '\0' || v < 0) {
+        fatal("Non-negative number argument expected.");
     }
-    memcpy(t->val, s, strlen(s) + 1);
-    t->next = NULL;
-    *endp   = t;
-    return (&t->next);
+    return (v);
 }
 
-void freetopic(struct topic *endp)
+// Parses "<a>,<b>" into two integers.
+static void pairarg(const char *val, int maxv, uint32_t *a, uint32_t *b)
 {
-    struct topic *t = endp;
+    char        buf[32];
+    const char *comma = strchr(val, ',');
 
-    for (struct topic *t = endp; t != NULL; t = t->next) {
-        if (t->val) {
-            free(t->val);
-            t->val = NULL;
+    if (comma == NULL || (size_t)(comma - val) >= sizeof(buf)) {
+        fatal("Argument of the form <num>,<num> expected.");
+    }
+    memcpy(buf, val, comma - val);
+    buf[comma - val] = '\0';
+    *a               = intarg(buf, maxv);
+    *b               = intarg(comma + 1, maxv);
+}
+
+static char *config_strdup(const char *s)
+{
+    char *p;
+
+    if ((p = arena_strdup(&arena, s)) == NULL) {
+        fatal("Out of memory.");
+    }
+    return (p);
+}
+
+static enum transport transport_of(const char *url)
+{
+    for (size_t i = 0;
+         i < sizeof(transport_schemes) / sizeof(transport_schemes[0]); i++) {
+        if (strncmp(url, transport_schemes[i],
+                    strlen(transport_schemes[i])) == 0) {
+#ifndef NNG_SUPP_QUIC
+            if (i == TRANSPORT_QUIC) {
+                fatal("%s needs nng built with QUIC support; reconfigure "
+                      "with -DNNG_ENABLE_QUIC=ON.",
+                      url);
+            }
+#endif
+            return (enum transport) i;
         }
     }
-    free(t);
+    fatal("Unsupported url %s: expected mqtt-tcp://, tls+mqtt-tcp://, "
+          "ws://, wss:// or mqtt-quic://.",
+          url);
+    return (TRANSPORT_TCP);
+}
+
+struct topic **addtopic(struct topic **endp, const char *s)
+{
+    struct topic *t;
+
+    if ((t = arena_alloc(&arena, sizeof(*t), sizeof(void *))) == NULL) {
+        fatal("Out of memory.");
+    }
+    t->val  = config_strdup(s);
+    t->next = NULL;
+    *endp   = t;
+    return (&t->next);
 }
 
 int client_parse_opts(int argc, char **argv, client_opts *opts)
@@ -343,6 +678,21 @@ int client_parse_opts(int argc, char **argv, client_opts *opts)
         case OPT_INTERVAL:
             opts->interval = intarg(arg, 10240000);
             break;
+        case OPT_CONNS:
+            opts->conns = intarg(arg, 1024000);
+            if (opts->conns == 0) {
+                fatal("Connections (--conns) must be at least 1.");
+            }
+            break;
+        case OPT_PIPELINE:
+            opts->pipeline = intarg(arg, 65535);
+            if (opts->pipeline == 0) {
+                fatal("Pipeline depth (--pipeline) must be at least 1.");
+            }
+            break;
+        case OPT_COALESCE:
+            opts->coalesce = true;
+            break;
         case OPT_MSGCOUNT:
             opts->msg_count = intarg(arg, 10240000);
             break;
@@ -353,7 +703,7 @@ int client_parse_opts(int argc, char **argv, client_opts *opts)
             ASSERT_NULL(opts->url,
                         "URL (--url) may be specified "
                         "only once.");
-            opts->url = nng_strdup(arg);
+            opts->url = config_strdup(arg);
             break;
         case OPT_TOPIC:
             topicend = addtopic(topicend, arg);
@@ -370,7 +720,7 @@ int client_parse_opts(int argc, char **argv, client_opts *opts)
                         "User (-u, --user) may be specified "
                         "only "
                         "once.");
-            opts->user = nng_strdup(arg);
+            opts->user = config_strdup(arg);
             break;
         case OPT_PASSWD:
             ASSERT_NULL(opts->passwd,
@@ -378,7 +728,7 @@ int client_parse_opts(int argc, char **argv, client_opts *opts)
                         "specified "
                         "only "
                         "once.");
-            opts->passwd = nng_strdup(arg);
+            opts->passwd = config_strdup(arg);
             break;
         case OPT_CLIENTID:
             ASSERT_NULL(opts->client_id,
@@ -386,7 +736,7 @@ int client_parse_opts(int argc, char **argv, client_opts *opts)
                         "specified "
                         "only "
                         "once.");
-            opts->client_id = nng_strdup(arg);
+            opts->client_id = config_strdup(arg);
             break;
         case OPT_KEEPALIVE:
             opts->keepalive = intarg(arg, 65535);
@@ -399,7 +749,7 @@ int client_parse_opts(int argc, char **argv, client_opts *opts)
                         "Will_msg (--will-msg) may be specified "
                         "only "
                         "once.");
-            opts->will_msg     = nng_strdup(arg);
+            opts->will_msg     = config_strdup(arg);
             opts->will_msg_len = strlen(arg);
             break;
         case OPT_WILL_QOS:
@@ -414,7 +764,7 @@ int client_parse_opts(int argc, char **argv, client_opts *opts)
                         "specified "
                         "only "
                         "once.");
-            opts->will_topic = nng_strdup(arg);
+            opts->will_topic = config_strdup(arg);
             break;
         case OPT_SECURE:
             opts->enable_ssl = true;
@@ -440,14 +790,14 @@ int client_parse_opts(int argc, char **argv, client_opts *opts)
             ASSERT_NULL(opts->keypass,
                         "Key Password (--keypass) may be specified only "
                         "once.");
-            opts->keypass = nng_strdup(arg);
+            opts->keypass = config_strdup(arg);
             break;
         case OPT_MSG:
             ASSERT_NULL(opts->msg,
                         "Data (--file, --data) may be "
                         "specified "
                         "only once.");
-            opts->msg     = nng_strdup(arg);
+            opts->msg     = config_strdup(arg);
             opts->msg_len = strlen(arg);
             break;
         case OPT_FILE:
@@ -457,6 +807,135 @@ int client_parse_opts(int argc, char **argv, client_opts *opts)
                         "only once.");
             loadfile(arg, (void **) &opts->msg, &opts->msg_len);
             break;
+        case OPT_CORPUS:
+            ASSERT_NULL(opts->corpus_file,
+                        "Corpus (--corpus) may be specified only once.");
+            opts->corpus_file = config_strdup(arg);
+            break;
+        case OPT_CORPUS_FORMAT:
+            if (strcmp(arg, "lines") == 0) {
+                opts->corpus_format = CORPUS_LINES;
+            } else if (strcmp(arg, "len32") == 0) {
+                opts->corpus_format = CORPUS_LEN32;
+            } else {
+                fatal("Unknown corpus format %s (--corpus-format): "
+                      "expected lines or len32.",
+                      arg);
+            }
+            break;
+        case OPT_RATE:
+            opts->rate = intarg(arg, 100000000);
+            break;
+        case OPT_FIND_MAX:
+            opts->find_max = true;
+            break;
+        case OPT_MAX_RATE:
+            opts->max_rate = intarg(arg, 100000000);
+            break;
+        case OPT_STEP_TIME:
+            opts->step_time = intarg(arg, 86400);
+            break;
+        case OPT_SLO_P99:
+            opts->slo_p99 = intarg(arg, LATENCY_MAX_US);
+            break;
+        case OPT_SLO_LOSS:
+            opts->slo_loss = floatarg(arg);
+            break;
+        case OPT_CHECKSUM:
+            opts->checksum = true;
+            break;
+        case OPT_STAMP:
+            opts->stamp = true;
+            break;
+        case OPT_TOPIC_VARY:
+            opts->topic_vary = intarg(arg, 100000000);
+            break;
+        case OPT_BUSY:
+            opts->consumer.busy_us = intarg(arg, 10000000);
+            break;
+        case OPT_HASH:
+            opts->consumer.hash = true;
+            break;
+        case OPT_QUEUE:
+            opts->consumer.queue_len = intarg(arg, 100000000);
+            break;
+        case OPT_CONSUMERS:
+            opts->consumer.threads = intarg(arg, 1024);
+            break;
+        case OPT_QUEUE_DROP:
+            opts->consumer.drop = true;
+            break;
+        case OPT_PAUSE:
+            pairarg(arg, 86400000, &opts->pause_run, &opts->pause_len);
+            // A zero run would leave the subscriber paused for good.
+            if (opts->pause_run == 0) {
+                fatal("Run length (--pause) must be at least 1 ms.");
+            }
+            break;
+        case OPT_REPEAT:
+            opts->repeat = intarg(arg, 10000);
+            if (opts->repeat == 0) {
+                fatal("Runs (--repeat) must be at least 1.");
+            }
+            break;
+        case OPT_DURATION:
+            opts->duration = intarg(arg, 31536000);
+            break;
+        case OPT_JSON:
+            ASSERT_NULL(opts->json,
+                        "Result file (--json) may be specified only once.");
+            opts->json = config_strdup(arg);
+            break;
+        case OPT_PROFILE:
+            opts->profile = true;
+            break;
+        case OPT_CREDENTIALS: {
+            char * data;
+            size_t len;
+            ASSERT_NULL(opts->creds.arena,
+                        "Credentials (--credentials) may be specified only "
+                        "once.");
+            loadfile(arg, (void **) &data, &len);
+            if ((rv = credentials_parse(&opts->creds, data, len)) != 0) {
+                fatal("Cannot load credentials from %s: %s", arg,
+                      rv == NNG_EINVAL ? "no usable lines"
+                                       : nng_strerror(rv));
+            }
+            break;
+        }
+        case OPT_CONN_RATE:
+            opts->launch.rate = intarg(arg, 100000000);
+            break;
+        case OPT_CONN_BATCH:
+            opts->launch.batch = intarg(arg, 100000000);
+            if (opts->launch.batch == 0) {
+                fatal("Batch size (--conn-batch) must be at least 1.");
+            }
+            break;
+        case OPT_CONN_JITTER:
+            opts->launch.jitter_ms = intarg(arg, 3600000);
+            break;
+        case OPT_LAUNCH_THREADS:
+            opts->launch.threads = intarg(arg, 1024);
+            if (opts->launch.threads == 0) {
+                fatal("Launch threads (--launch-threads) must be at least 1.");
+            }
+            break;
+        case OPT_RECONNECT:
+            pairarg(arg, 3600000, &opts->reconn_min, &opts->reconn_max);
+            if (opts->reconn_max < opts->reconn_min) {
+                fatal("Reconnect backoff (--reconnect) max is below min.");
+            }
+            break;
+        case OPT_WORST:
+            opts->worst = intarg(arg, 1024000);
+            break;
+        case OPT_HDR_LOG:
+            ASSERT_NULL(opts->hdr_log,
+                        "HdrHistogram log (--hdr-log) may be specified "
+                        "only once.");
+            opts->hdr_log = config_strdup(arg);
+            break;
         }
     }
     switch (rv) {
@@ -474,8 +953,9 @@ int client_parse_opts(int argc, char **argv, client_opts *opts)
     }
 
     if (!opts->url) {
-        opts->url = nng_strdup("mqtt-tcp://127.0.0.1:1883");
+        opts->url = config_strdup("mqtt-tcp://127.0.0.1:1883");
     }
+    opts->transport = transport_of(opts->url);
 
     switch (opts->type) {
     case PUB:
@@ -485,11 +965,28 @@ int client_parse_opts(int argc, char **argv, client_opts *opts)
                   "information. ");
         }
 
-        if (opts->msg == NULL) {
+        if (opts->msg == NULL && opts->corpus_file == NULL) {
             fatal("Missing required option: '(-m, --msg) "
-                  "<message>' or '(-f, --file) <file>'\nTry "
+                  "<message>', '(-f, --file) <file>' or '--corpus "
+                  "<file>'\nTry "
                   "'" APP_NAME " pub --help' for more information. ");
         }
+        if (opts->corpus_file != NULL) {
+            if (opts->msg != NULL) {
+                fatal("Data (--file, --data) and --corpus are mutually "
+                      "exclusive.");
+            }
+            if ((rv = corpus_open(&opts->corpus, opts->corpus_file,
+                                  opts->corpus_format)) != 0) {
+                fatal("Cannot load corpus %s: %s", opts->corpus_file,
+                      rv == NNG_EINVAL ? "no records, or malformed"
+                                       : nng_strerror(rv));
+            }
+            printf("corpus: %zu records in %zu bytes, index: %zu bytes\n",
+                   opts->corpus.count, opts->corpus.len,
+                   opts->corpus.count *
+                       (sizeof(uint64_t) + sizeof(uint32_t)));
+        }
         break;
     case SUB:
         if (opts->topic_count == 0) {
@@ -507,6 +1004,34 @@ int client_parse_opts(int argc, char **argv, client_opts *opts)
         break;
     }
 
+    if (opts->find_max) {
+        if (opts->type != PUB) {
+            fatal("--find-max is only supported by pub.");
+        }
+        if (opts->msg_count > 0) {
+            fatal("--find-max cannot be combined with (-C, --count).");
+        }
+        if (opts->step_time == 0) {
+            fatal("Step time (--step-time) must be at least 1.");
+        }
+        if (opts->rate == 0) {
+            opts->rate = 1000;
+        }
+        if (opts->repeat > 1 || opts->duration > 0 || opts->json) {
+            fatal("--find-max cannot be combined with --repeat, --duration "
+                  "or --json.");
+        }
+    }
+    if (opts->type == CONN &&
+        (opts->repeat > 1 || opts->duration > 0 || opts->json)) {
+        fatal("--repeat, --duration and --json are only supported by pub "
+              "and sub.");
+    }
+    if (opts->repeat > 1 && opts->duration == 0 &&
+        !(opts->type == PUB && opts->msg_count > 0)) {
+        fatal("--repeat needs --duration or (-C, --count) to end each run.");
+    }
+
     return rv;
 }
 
@@ -516,13 +1041,26 @@ static void set_default_conf(client_opts *opts)
     opts->interval      = 0;
     opts->qos           = 0;
     opts->retain        = false;
+    opts->conns         = 1;
     opts->parallel      = 1;
+    opts->pipeline      = 1;
     opts->version       = 4;
     opts->keepalive     = 60;
     opts->clean_session = true;
     opts->enable_ssl    = false;
     opts->verbose       = false;
     opts->topic_count   = 0;
+    opts->max_rate      = 1000000;
+    opts->step_time     = 10;
+    opts->slo_p99       = 10000;
+    opts->slo_loss      = 0.1;
+    opts->repeat        = 1;
+    opts->worst         = 3;
+
+    opts->launch.batch   = 1;
+    opts->launch.threads = 4;
+
+    opts->consumer.threads = 1;
 }
 
 // This reads a file into memory.  Care is taken to ensure that
@@ -577,8 +1115,11 @@ static void loadfile(const char *path, void **datap, size_t *lenp)
         fclose(f);
     }
     fdata[total_read] = '\0';
-    *datap            = fdata;
-    *lenp             = total_read;
+    if ((*datap = arena_memdup(&arena, fdata, total_read + 1)) == NULL) {
+        fatal("Out of memory.");
+    }
+    *lenp = total_read;
+    free(fdata);
 }
 
 #ifdef NNG_SUPP_TLS
@@ -616,47 +1157,209 @@ out:
 
 #endif
 
-nng_msg *publish_msg(client_opts *opts)
+static nng_msg *publish_msg(struct work *work)
 {
-    // create a PUBLISH message
-    nng_msg *pubmsg;
-    nng_mqtt_msg_alloc(&pubmsg, 0);
-    nng_mqtt_msg_set_packet_type(pubmsg, NNG_MQTT_PUBLISH);
-    nng_mqtt_msg_set_publish_qos(pubmsg, opts->qos);
-    nng_mqtt_msg_set_publish_retain(pubmsg, opts->retain);
-    nng_mqtt_msg_set_publish_payload(pubmsg, opts->msg, opts->msg_len);
-    nng_mqtt_msg_set_publish_topic(pubmsg, opts->topic->val);
+    struct corpus *corpus = &work->opts->corpus;
+    nng_msg *      msg;
+
+    // Each corpus record makes a message of its own; otherwise the
+    // template is patched and duplicated.
+    if (corpus->count > 0) {
+        const uint8_t *rec;
+        size_t         len;
+        rec = corpus_next(corpus, &len);
+        msg = pub_template_build(&work->tmpl, work->seq++,
+                                 work->intended + wall_offset_us, rec, len);
+    } else {
+        msg = pub_template_next(&work->tmpl, work->seq++,
+                                work->intended + wall_offset_us);
+    }
+    if (msg == NULL) {
+        nng_fatal("nng_msg_dup", NNG_ENOMEM);
+    }
+    return msg;
+}
 
-    return pubmsg;
+static void mark_first(uint64_t now)
+{
+    unsigned long long zero = 0;
+    atomic_compare_exchange_strong(&first_us, &zero, now);
 }
 
-void client_cb(void *arg)
+static void work_retire(struct work *work)
+{
+    work->state = DONE;
+    pub_active--;
+}
+
+static void send_start(struct work *work)
+{
+    mark_first(bench_clock_us());
+    nng_aio_set_msg(work->aio, publish_msg(work));
+    // Set per send: nng_sleep_aio() replaces the timeout of the aio.
+    nng_aio_set_timeout(work->aio, SEND_TIMEOUT_MS);
+    work->state = SEND;
+    nng_ctx_send(work->ctx, work->aio);
+}
+
+// Claims the next message and sends it when it falls due. With --count
+// the work retires once the budget is spent.
+static void send_next(struct work *work)
+{
+    client_opts *opts     = work->opts;
+    uint64_t     now      = bench_clock_us();
+    uint64_t     interval = interval_ns;
+
+    if (exit_signal ||
+        (opts->msg_count > 0 && atomic_fetch_sub(&send_budget, 1) <= 0)) {
+        work_retire(work);
+        return;
+    }
+    if (interval == 0) {
+        work->intended = now;
+    } else {
+        // Keep a fixed-rate schedule: the next send is due one interval
+        // after the previous one was due, however long that one took.
+        work->intended =
+            atomic_fetch_add(&work->lane->next_due, interval) / 1000;
+        // Sends that fell due while the lane overslept in a timer are
+        // late because of the generator, so they are timed from the
+        // wake-up (see SEND_WAIT).
+        uint64_t woken = work->lane->woken;
+        if (work->intended < woken) {
+            work->intended = woken;
+        }
+    }
+    // A send that is already due, because the previous one took longer
+    // than the interval, goes out at once and is timed from when it was
+    // due. Only a send ahead of schedule sleeps.
+    if (work->intended > now) {
+        work->state = SEND_WAIT;
+        nng_sleep_aio((work->intended - now + 999) / 1000, work->aio);
+        return;
+    }
+    send_start(work);
+}
+
+static int template_flags(client_opts *opts)
+{
+    return (opts->stamp ? PUB_TEMPLATE_STAMP : 0) |
+        (opts->checksum ? PUB_TEMPLATE_CHECKSUM : 0);
+}
+
+static void verify_payload(const uint8_t *payload, size_t len)
+{
+    switch (checksum_verify(payload, len)) {
+    case CHECKSUM_OK:
+        recv_verified++;
+        break;
+    case CHECKSUM_CORRUPT:
+        recv_corrupt++;
+        break;
+    case CHECKSUM_TRUNCATED:
+        recv_truncated++;
+        break;
+    }
+}
+
+// Posts the next receive, unless --pause says the reader is stalled.
+static void recv_next(struct work *work)
+{
+    client_opts *opts = work->opts;
+
+    if (opts->pause_len > 0) {
+        nng_time phase =
+            (nng_clock() - recv_start) % (opts->pause_run + opts->pause_len);
+        if (phase >= opts->pause_run) {
+            work->state = RECV_PAUSE;
+            nng_sleep_aio(opts->pause_run + opts->pause_len - phase,
+                          work->aio);
+            return;
+        }
+    }
+    work->state = RECV;
+    nng_ctx_recv(work->ctx, work->aio);
+}
+
+// Hands the received message to the consumer. A full queue in blocking
+// mode stalls this context, which is what pushes back on the broker.
+static void recv_consume(struct work *work)
+{
+    if (consumer->cfg.queue_len == 0) {
+        consumer_handle(consumer, work->msg);
+    } else if (consumer_push(consumer, work->msg) == NNG_EAGAIN) {
+        work->state = RECV_FULL;
+        consumer_wait(consumer, work->aio);
+        return;
+    }
+    work->msg = NULL;
+    recv_next(work);
+}
+
+// Frees the message a completion hands over, or the one this work was
+// holding on to, and parks the work for good.
+static void work_drop(struct work *work)
+{
+    nng_msg *msg = nng_aio_get_msg(work->aio);
+    int      rv  = nng_aio_result(work->aio);
+
+    switch (work->state) {
+    case SEND:
+        // A failed send leaves the message with us.
+        if (rv != 0 && msg != NULL) {
+            nng_msg_free(msg);
+        }
+        break;
+    case RECV:
+        if (rv == 0 && msg != NULL) {
+            nng_msg_free(msg);
+        }
+        break;
+    case RECV_WAIT:
+    case RECV_FULL:
+        nng_msg_free(work->msg);
+        work->msg = NULL;
+        break;
+    default:
+        break;
+    }
+    nng_aio_set_msg(work->aio, NULL);
+    work->state = DONE;
+}
+
+static void client_step(struct work *work)
 {
-    struct work *work = arg;
     nng_msg *    msg;
+    uint64_t     now;
     int          rv;
 
+    if (stopping) {
+        work_drop(work);
+        return;
+    }
+
     switch (work->state) {
     case INIT:
         switch (work->opts->type) {
         case PUB:
-            if (work->opts->msg_count > 0) {
-                if (--send_count < 0) {
-                    break;
-                }
+            if ((rv = pub_template_init(&work->tmpl, work->opts->topic->val,
+                                        work->opts->qos, work->opts->retain,
+                                        work->opts->msg != NULL
+                                            ? work->opts->msg
+                                            : (uint8_t *) "",
+                                        work->opts->msg_len,
+                                        template_flags(work->opts),
+                                        work->opts->topic_vary, work->id)) !=
+                0) {
+                nng_fatal("pub_template_init", rv);
             }
-            work->msg = publish_msg(work->opts);
-            nng_msg_dup(&msg, work->msg);
-            nng_aio_set_msg(work->aio, msg);
-            msg         = NULL;
-            work->state = SEND;
-            nng_ctx_send(work->ctx, work->aio);
-            // nng_sleep_aio(0, work->aio);
+            work->msg = work->tmpl.msg;
+            pub_active++;
+            send_next(work);
             break;
         case SUB:
         case CONN:
-            work->state = RECV;
-            nng_ctx_recv(work->ctx, work->aio);
+            recv_next(work);
             break;
         }
         break;
@@ -676,47 +1379,90 @@ void client_cb(void *arg)
 
     case RECV_WAIT:
         msg = work->msg;
-        // uint32_t payload_len;
-        // uint8_t *payload = nng_mqtt_msg_get_publish_payload(msg,
-        // &payload_len); uint32_t topic_len; const char *recv_topic =
+        uint32_t payload_len = 0;
+        uint8_t *payload     = NULL;
+        if (nng_mqtt_msg_get_packet_type(msg) == NNG_MQTT_PUBLISH) {
+            payload = nng_mqtt_msg_get_publish_payload(msg, &payload_len);
+        }
+        // uint32_t topic_len; const char *recv_topic =
         //     nng_mqtt_msg_get_publish_topic(msg, &topic_len);
 
         // printf("%.*s: %.*s\n", topic_len, recv_topic, payload_len,
         //        (char *) payload);
+        now = bench_clock_us();
+        mark_first(now);
+        last_us = now;
+        stats_received(latency, work->cstats, payload, payload_len,
+                       now + wall_offset_us);
+        if (work->opts->checksum) {
+            verify_payload(payload, payload_len);
+        }
         recv_count++;
-        nng_msg_header_clear(work->msg);
-        nng_msg_clear(work->msg);
+        recv_consume(work);
+        break;
 
+    case RECV_FULL:
+        if (nng_aio_result(work->aio) != 0) {
+            nng_msg_free(work->msg);
+            work->msg   = NULL;
+            work->state = DONE;
+            break;
+        }
+        recv_consume(work);
+        break;
+
+    case RECV_PAUSE:
         work->state = RECV;
         nng_ctx_recv(work->ctx, work->aio);
         break;
 
     case SEND:
+        now = bench_clock_us();
         if ((rv = nng_aio_result(work->aio)) != 0) {
-            nng_msg_free(work->msg);
-            nng_fatal("nng_send_aio", rv);
-        }
-        nng_msg_dup(&msg, work->msg);
-        nng_aio_set_msg(work->aio, msg);
-        work->state = SEND_WAIT;
-        if (work->opts->interval) {
-            nng_sleep_aio(work->opts->interval, work->aio);
+            nng_msg_free(nng_aio_get_msg(work->aio));
+            nng_aio_set_msg(work->aio, NULL);
+            send_errors++;
+            if (work->opts->verbose) {
+                printf("send failed: %s\n", nng_strerror(rv));
+            }
         } else {
-            nng_aio_finish(work->aio, 0);
+            stats_sent(latency, work->cstats, (int64_t)(now - work->intended));
+            send_done++;
+        }
+        last_us = now;
+        if (work->opts->msg_count > 0 &&
+            atomic_fetch_add(&send_finished, 1) + 1 ==
+                (long) work->opts->msg_count) {
+            work_retire(work);
+            goto out;
+        }
+        if (rv == NNG_ECLOSED) {
+            work_retire(work);
+            break;
         }
+        send_next(work);
         break;
 
     case SEND_WAIT:
-        if (work->opts->msg_count > 0) {
-            if (--send_count < 0) {
-                goto out;
-            }
+        // A --duration run may have ended while this send was waiting.
+        if (exit_signal) {
+            work_retire(work);
+            break;
         }
-        if (work->opts->interval == 0) {
-            goto out;
+        // nng sleeps in whole milliseconds, so the wake-up comes up to a
+        // millisecond past the due time. That is the generator's timer,
+        // not the broker, so this send, and those of the lane that fell
+        // due meanwhile, are timed from the wake-up instead. The lane's
+        // schedule is unaffected.
+        now = bench_clock_us();
+        if (now > work->intended) {
+            work->intended = now;
         }
-        work->state = SEND;
-        nng_ctx_send(work->ctx, work->aio);
+        work->lane->woken = now;
+        send_start(work);
+        break;
+
+    case DONE:
         break;
 
     default:
@@ -729,259 +1475,927 @@ void client_cb(void *arg)
     }
 }
 
-static struct work *alloc_work(nng_socket sock, client_opts *opts)
+void client_cb(void *arg)
 {
-    struct work *w;
-    int          rv;
+    struct work *work = arg;
+    uint64_t     cpu;
 
-    if ((w = nng_alloc(sizeof(*w))) == NULL) {
-        nng_fatal("nng_alloc", NNG_ENOMEM);
+    if (profile == NULL) {
+        client_step(work);
+        return;
     }
+    cpu = profile_thread_ns();
+    client_step(work);
+    profile_phase_add(profile,
+                      work->opts->type == PUB ? PHASE_SEND : PHASE_RECV,
+                      profile_thread_ns() - cpu);
+}
+
+static void init_work(struct work *w, nng_socket sock, client_opts *opts,
+                      struct lane *lane, struct conn_stats *cstats,
+                      uint32_t id)
+{
+    int rv;
+
     if ((rv = nng_aio_alloc(&w->aio, client_cb, w)) != 0) {
         nng_fatal("nng_aio_alloc", rv);
     }
     if ((rv = nng_ctx_open(&w->ctx, sock)) != 0) {
         nng_fatal("nng_ctx_open", rv);
     }
-    w->opts  = opts;
-    w->state = INIT;
-    return (w);
+    w->opts   = opts;
+    w->lane   = lane;
+    w->cstats = cstats;
+    w->id     = id;
+    w->state  = INIT;
 }
 
-static nng_msg *connect_msg(client_opts *opts)
+// The CONNECT of each connection is built from these, see message.h.
+static void connect_cfg_init(client_opts *opts)
 {
-    nng_msg *msg;
-    nng_mqtt_msg_alloc(&msg, 0);
-    nng_mqtt_msg_set_packet_type(msg, NNG_MQTT_CONNECT);
-    nng_mqtt_msg_set_connect_proto_version(msg, opts->version);
-    nng_mqtt_msg_set_connect_keep_alive(msg, opts->keepalive);
-    nng_mqtt_msg_set_connect_clean_session(msg, opts->clean_session);
+    opts->connect = (struct connect_cfg){
+        .version       = opts->version,
+        .keepalive     = opts->keepalive,
+        .clean_session = opts->clean_session,
+        .client_id     = opts->client_id,
+        .conns         = opts->conns,
+        .user          = opts->user,
+        .passwd        = opts->passwd,
+        .creds         = &opts->creds,
+        .will_topic    = opts->will_topic,
+        .will_qos      = opts->will_qos,
+        .will_msg      = opts->will_msg,
+        .will_msg_len  = opts->will_msg_len,
+        .will_retain   = opts->will_retain,
+    };
+}
 
-    if (opts->client_id) {
-        nng_mqtt_msg_set_connect_client_id(msg, opts->client_id);
-    }
-    if (opts->user) {
-        nng_mqtt_msg_set_connect_user_name(msg, opts->user);
+static void print_latency(const char *what, const struct hdr_histogram *h)
+{
+    if (hdr_count(h) == 0) {
+        return;
     }
-    if (opts->passwd) {
-        nng_mqtt_msg_set_connect_password(msg, opts->passwd);
+    printf("latency %s: count: %ld, min: %ldus, p50: %ldus, p99: %ldus, "
+           "p99.9: %ldus, max: %ldus\n",
+           what, hdr_count(h), hdr_min(h), hdr_value_at_percentile(h, 50.0),
+           hdr_value_at_percentile(h, 99.0), hdr_value_at_percentile(h, 99.9),
+           hdr_max(h));
+}
+
+struct connect_param {
+    nng_socket *  sock;
+    client_opts * opts;
+    atomic_ullong dial_us; // start of the current connection attempt
+    atomic_bool   connected; // CONNACK received, whatever the outcome
+    atomic_bool   up;        // CONNACK accepted
+    bool          ever_up;
+};
+
+// CONNACK outcome by reason code; MQTT 3.1.1 and 5.0 number the same
+// refusals differently.
+enum auth_outcome {
+    AUTH_ACCEPTED,
+    AUTH_BAD_CREDENTIALS,
+    AUTH_NOT_AUTHORIZED,
+    AUTH_REFUSED,
+    AUTH_COUNT
+};
+
+static const char *auth_outcome_names[AUTH_COUNT] = {
+    "connack accepted",
+    "connack bad credentials",
+    "connack not authorized",
+    "connack refused",
+};
+
+// Time from starting a connection attempt to its CONNACK, by outcome.
+static struct hdr_histogram *connack_latency[AUTH_COUNT];
+
+// Dials the connections and follows them coming up, see launcher.h.
+static struct launcher launcher;
+
+static enum auth_outcome auth_outcome(int reason)
+{
+    switch (reason) {
+    case 0:
+        return AUTH_ACCEPTED;
+    case 4:    // bad user name or password
+    case 0x86: // bad user name or password (5.0)
+        return AUTH_BAD_CREDENTIALS;
+    case 5:    // not authorized
+    case 0x87: // not authorized (5.0)
+        return AUTH_NOT_AUTHORIZED;
+    default:
+        return AUTH_REFUSED;
     }
-    if (opts->will_topic) {
-        nng_mqtt_msg_set_connect_will_topic(msg, opts->will_topic);
+}
+
+static void connack_record(struct connect_param *param, int reason)
+{
+    uint64_t now = bench_clock_us();
+
+    if (atomic_exchange(&param->connected, true)) {
+        return;
     }
-    if (opts->will_qos) {
-        nng_mqtt_msg_set_connect_will_qos(msg, opts->will_qos);
+    hdr_record(connack_latency[auth_outcome(reason)],
+               (int64_t)(now - param->dial_us));
+    if (auth_outcome(reason) == AUTH_ACCEPTED &&
+        !atomic_exchange(&param->up, true)) {
+        launcher_up(&launcher, !param->ever_up);
+        param->ever_up = true;
     }
-    if (opts->will_msg) {
-        nng_mqtt_msg_set_connect_will_msg(msg, opts->will_msg,
-                                          opts->will_msg_len);
+}
+
+static void print_connack(void)
+{
+    for (int i = 0; i < AUTH_COUNT; i++) {
+        print_latency(auth_outcome_names[i], connack_latency[i]);
     }
-    if (opts->will_retain) {
-        nng_mqtt_msg_set_connect_will_retain(msg, opts->will_retain);
+}
+
+// Counts the CONNACK and, once accepted, subscribes a sub client.
+static void connected(struct connect_param *param, int reason)
+{
+    if (stopping) {
+        return;
     }
+    connack_record(param, reason);
+    if (reason == 0 && param->opts->type == SUB &&
+        param->opts->topic_count > 0) {
+        // Connected succeed
+        nng_msg *msg;
+        nng_mqtt_msg_alloc(&msg, 0);
+        nng_mqtt_msg_set_packet_type(msg, NNG_MQTT_SUBSCRIBE);
+
+        nng_mqtt_topic_qos *topics_qos =
+            nng_mqtt_topic_qos_array_create(param->opts->topic_count);
+
+        size_t i = 0;
+        for (struct topic *tp = param->opts->topic;
+             tp != NULL && i < param->opts->topic_count;
+             tp = tp->next, i++) {
+            nng_mqtt_topic_qos_array_set(topics_qos, i, tp->val,
+                                         param->opts->qos);
+        }
 
-    return msg;
+        nng_mqtt_msg_set_subscribe_topics(msg, topics_qos,
+                                          param->opts->topic_count);
+
+        nng_mqtt_topic_qos_array_free(topics_qos, param->opts->topic_count);
+
+        // Send subscribe message
+        nng_sendmsg(*param->sock, msg, NNG_FLAG_NONBLOCK);
+    }
 }
 
-struct connect_param {
-    nng_socket * sock;
-    client_opts *opts;
-};
+// A connection closed before it was ever up means the broker refused
+// the CONNECT; reason is its reason code, 0 when unknown.
+static void disconnected(struct connect_param *param, int reason)
+{
+    if (stopping) {
+        return;
+    }
+    if (!param->connected) {
+        connack_record(param, reason != 0 ? reason : -1);
+    }
+    if (atomic_exchange(&param->up, false)) {
+        launcher_down(&launcher);
+    }
+    // The client redials on its own; time the next attempt from here.
+    param->connected = false;
+    param->dial_us   = bench_clock_us();
+}
 
 void
 connect_cb(nng_pipe p, nng_pipe_ev ev, void *arg)
 {
-	printf("%s: connected!\n", __FUNCTION__);
     struct connect_param *param    = arg;
-    // uint8_t               ret_code = nng_mqtt_msg_get_connack_return_code(msg);
-    // printf("%s(%d)\n",
-    //        ret_code == 0 ? "connection established" : "connect failed",
-    //        ret_code);
-
-    // nng_msg_free(msg);
-    // msg = NULL;
-
-    // if (ret_code == 0) {
-        if (param->opts->type == SUB && param->opts->topic_count > 0) {
-            // Connected succeed
-            nng_msg *msg;
-            nng_mqtt_msg_alloc(&msg, 0);
-            nng_mqtt_msg_set_packet_type(msg, NNG_MQTT_SUBSCRIBE);
-
-            nng_mqtt_topic_qos *topics_qos =
-                nng_mqtt_topic_qos_array_create(param->opts->topic_count);
-
-            size_t i = 0;
-            for (struct topic *tp = param->opts->topic;
-                 tp != NULL && i < param->opts->topic_count;
-                 tp = tp->next, i++) {
-                nng_mqtt_topic_qos_array_set(topics_qos, i, tp->val,
-                                             param->opts->qos);
-            }
+    int                   reason   = 0;
 
-            nng_mqtt_msg_set_subscribe_topics(msg, topics_qos,
-                                              param->opts->topic_count);
-
-            nng_mqtt_topic_qos_array_free(topics_qos, param->opts->topic_count);
-
-            // Send subscribe message
-            nng_sendmsg(*param->sock, msg, NNG_FLAG_NONBLOCK);
-        }
-    // } else {
-    //     fatal("connect failed: %d", ret_code);
-    // }
+    nng_pipe_get_int(p, NNG_OPT_MQTT_CONNECT_REASON, &reason);
+    if (param->opts->verbose) {
+        printf("%s: connected, reason: %d\n", __FUNCTION__, reason);
+    }
+    connected(param, reason);
 }
 
 // Disconnect message callback function
 void
 disconnect_cb(nng_pipe p, nng_pipe_ev ev, void *arg)
 {
-	printf("%s: disconnected!\n", __FUNCTION__);
+    struct connect_param *param  = arg;
+    int                   reason = 0;
+
+    if (!param->connected) {
+        nng_pipe_get_int(p, NNG_OPT_MQTT_DISCONNECT_REASON, &reason);
+    }
+    if (param->opts->verbose) {
+        printf("%s: disconnected\n", __FUNCTION__);
+    }
+    disconnected(param, reason);
 }
 
-void client(int argc, char **argv, enum client_type type)
+#ifdef NNG_SUPP_QUIC
+// The QUIC client hands over the CONNACK itself instead of a pipe.
+static int quic_connect_cb(void *rmsg, void *arg)
 {
-    int rv;
-    opts = nng_alloc(sizeof(client_opts));
-    set_default_conf(opts);
-    opts->type = type;
-
-    client_parse_opts(argc, argv, opts);
-
-    send_count            = opts->msg_count;
-    atomic_long msg_count = opts->msg_count;
-    if (opts->interval == 0 && opts->msg_count > 0) {
-        opts->interval = 1;
-    }
+    connected(arg, nng_mqtt_msg_get_connack_return_code(rmsg));
+    return (0);
+}
 
-    nng_socket    sock;
-    nng_dialer    dialer;
-    struct work **works = nng_alloc(sizeof(struct work *) * opts->parallel);
+static int quic_disconnect_cb(void *rmsg, void *arg)
+{
+    disconnected(arg, 0);
+    return (0);
+}
+#endif
 
-    if ((rv = nng_mqtt_client_open(&sock)) != 0) {
-        nng_fatal("nng_socket", rv);
-    }
+struct conn {
+    nng_socket           sock;
+    nng_dialer           dialer;
+    nng_msg *            connmsg; // QUIC only, sent by conn_dial()
+    struct connect_param param;
+};
 
-    for (size_t i = 0; i < opts->parallel; i++) {
-        works[i] = alloc_work(sock, opts);
+static void conn_prepare(struct conn *c, client_opts *opts, size_t index)
+{
+    nng_msg *msg;
+    int      rv;
+
+#ifdef NNG_SUPP_QUIC
+    // There is no dialer: the socket was opened on the url and connects
+    // when the CONNECT is sent on it.
+    if (opts->transport == TRANSPORT_QUIC) {
+        c->param.sock = &c->sock;
+        c->param.opts = opts;
+        nng_mqtt_quic_set_connect_cb(&c->sock, quic_connect_cb, &c->param);
+        nng_mqtt_quic_set_disconnect_cb(
+            &c->sock, quic_disconnect_cb, &c->param);
+        if ((c->connmsg = connect_msg(&opts->connect, index)) == NULL) {
+            nng_fatal("connect_msg", NNG_ENOMEM);
+        }
+        return;
     }
+#endif
 
-    nng_msg *msg = connect_msg(opts);
-
-    if ((rv = nng_dialer_create(&dialer, sock, opts->url)) != 0) {
+    if ((rv = nng_dialer_create(&c->dialer, c->sock, opts->url)) != 0) {
         nng_fatal("nng_dialer_create", rv);
     }
-    struct connect_param connect_arg = { .sock = &sock, .opts = opts };
-	nng_mqtt_set_connect_cb(sock, connect_cb, &connect_arg);
-	nng_mqtt_set_disconnect_cb(sock, disconnect_cb, NULL);
+    c->param.sock = &c->sock;
+    c->param.opts = opts;
+    nng_mqtt_set_connect_cb(c->sock, connect_cb, &c->param);
+    nng_mqtt_set_disconnect_cb(c->sock, disconnect_cb, &c->param);
 #ifdef NNG_SUPP_TLS
     if (opts->enable_ssl) {
-        if ((rv = init_dialer_tls(dialer, opts->cacert, opts->cert, opts->key,
-                                  opts->keypass)) != 0) {
+        if ((rv = init_dialer_tls(c->dialer, opts->cacert, opts->cert,
+                                  opts->key, opts->keypass)) != 0) {
             fatal("init_dialer_tls", rv);
         }
     }
 #endif
 
+    // Opt-in only: Nagle trades latency for fewer, larger writes.
+    if (opts->coalesce &&
+        (rv = nng_dialer_set_bool(c->dialer, NNG_OPT_TCP_NODELAY, false)) !=
+            0 &&
+        opts->verbose) {
+        printf("TCP_NODELAY not supported by %s: %s\n", opts->url,
+               nng_strerror(rv));
+    }
+
+    // nng redials a lost or refused connection by itself, doubling the
+    // delay from min up to max.
+    if (opts->reconn_max > 0) {
+        nng_dialer_set_ms(c->dialer, NNG_OPT_RECONNMINT, opts->reconn_min);
+        nng_dialer_set_ms(c->dialer, NNG_OPT_RECONNMAXT, opts->reconn_max);
+    }
 
-    nng_dialer_set_ptr(dialer, NNG_OPT_MQTT_CONNMSG, msg);
-    nng_dialer_start(dialer, NNG_FLAG_NONBLOCK);
+    if ((msg = connect_msg(&opts->connect, index)) == NULL) {
+        nng_fatal("connect_msg", NNG_ENOMEM);
+    }
+    nng_dialer_set_ptr(c->dialer, NNG_OPT_MQTT_CONNMSG, msg);
+}
 
-    nng_time sleep_time = 1000;
-    nng_time start      = nng_clock();
+// The connections with their works, as set up by the launcher threads.
+struct conn_set {
+    client_opts *opts;
+    struct conn *conns;
+    struct work *works;
+    struct lane *lanes;
+};
 
-    for (size_t i = 0; i < opts->parallel; i++) {
-        client_cb(works[i]);
+static void conn_setup(void *arg, size_t index)
+{
+    struct conn_set *set  = arg;
+    client_opts *    opts = set->opts;
+    struct conn *    c    = &set->conns[index];
+    size_t           per  = opts->parallel * opts->pipeline;
+    int              rv;
+
+#ifdef NNG_SUPP_QUIC
+    if (opts->transport == TRANSPORT_QUIC) {
+        rv = nng_mqtt_quic_client_open(&c->sock, opts->url);
+    } else
+#endif
+        rv = nng_mqtt_client_open(&c->sock);
+    if (rv != 0) {
+        nng_fatal("nng_socket", rv);
+    }
+    // Works of one connection are adjacent: work i is on lane
+    // i / pipeline, and lane l on connection l / parallel.
+    for (size_t i = index * per; i < (index + 1) * per; i++) {
+        init_work(&set->works[i], c->sock, opts,
+                  &set->lanes[i / opts->pipeline], &conn_stats[index], i);
     }
-    nng_time used_time = 0;
-    uint64_t total     = 0;
+    conn_prepare(c, opts, index);
+}
 
-    uint64_t last_recv = 0;
-    uint64_t temp      = 0;
+static void conn_dial(void *arg, size_t index)
+{
+    struct conn_set *set = arg;
+    struct conn *    c   = &set->conns[index];
+
+    c->param.connected = false;
+    c->param.dial_us   = bench_clock_us();
+#ifdef NNG_SUPP_QUIC
+    if (c->connmsg != NULL) {
+        int rv;
+        if ((rv = nng_sendmsg(c->sock, c->connmsg, 0)) != 0) {
+            nng_fatal("nng_sendmsg", rv);
+        }
+        c->connmsg = NULL;
+        return;
+    }
+#endif
+    nng_dialer_start(c->dialer, NNG_FLAG_NONBLOCK);
+}
 
-    while (!exit_signal) {
-        nng_msleep(sleep_time);
-        used_time = nng_clock() - start - sleep_time;
-        if (used_time > 0) {
-            // used_time = used_time == 0 ? 1 : used_time;
-            switch (opts->type) {
-            case PUB:
-                /* code */
-                total = msg_count == 0
-                    ? 1
-                    : msg_count - send_count - opts->parallel;
-                printf("sent total: %ld, rate: %lf(msg/sec), time: %ldms\n",
-                       total, (total * 1000.0 / used_time), used_time);
+// Quiesces everything that can still call into the client state, so
+// that it can be released: every aio is stopped, which also waits for a
+// running callback, then the sockets are closed, taking their contexts,
+// dialers, redials and pipe callbacks with them.
+static void client_teardown(struct conn *conns, size_t nconns,
+                            struct work *works, size_t nworks)
+{
+    stopping    = true;
+    exit_signal = true;
+    for (size_t i = 0; i < nworks; i++) {
+        nng_aio_stop(works[i].aio);
+    }
+    for (size_t i = 0; i < nconns; i++) {
+        nng_close(conns[i].sock);
+        if (conns[i].connmsg != NULL) {
+            nng_msg_free(conns[i].connmsg);
+            conns[i].connmsg = NULL;
+        }
+    }
+    for (size_t i = 0; i < nworks; i++) {
+        nng_aio_free(works[i].aio);
+        works[i].aio = NULL;
+        pub_template_fini(&works[i].tmpl);
+    }
+}
 
-                break;
+static void print_consumer(void)
+{
+    struct consumer_stats st;
 
-            case SUB:
-                /* code */
-                if (last_recv != recv_count) {
-                    total     = recv_count;
-                    temp      = last_recv;
-                    last_recv = recv_count;
-                    printf("recv total: %ld, rate: %ld(msg/sec), time: %ld\n",
-                           recv_count, total - temp, used_time);
-                }
-                break;
+    if (consumer == NULL) {
+        return;
+    }
+    consumer_stats(consumer, &st);
+    printf("processed: %ld, dropped: %ld", st.processed, st.dropped);
+    if (consumer->cfg.queue_len > 0) {
+        printf(", queue: %zu/%zu, max: %zu", st.depth,
+               consumer->cfg.queue_len, st.max_depth);
+    }
+    printf("\n");
+}
 
-            default:
-                break;
-            }
-        }
+static void print_verify(void)
+{
+    printf("verified: %ld, corrupt: %ld, truncated: %ld\n",
+           (long) recv_verified, (long) recv_corrupt, (long) recv_truncated);
+}
+
+static void print_summary(client_opts *opts)
+{
+    uint64_t elapsed = last_us > first_us ? last_us - first_us : 0;
+    long     total   = opts->type == PUB ? send_done : recv_count;
+
+    printf("%s total: %ld, ", opts->type == PUB ? "sent" : "recv", total);
+    if (opts->type == PUB) {
+        printf("errors: %ld, ", (long) send_errors);
     }
+    printf("time: %.3fs, rate: %.1f(msg/sec)\n", elapsed / 1e6,
+           elapsed > 0 ? total * 1e6 / elapsed : 0.0);
+}
 
-    // printf("used time: %ldms\n", used_time);
-    // used_time  = used_time == 0 ? 1 : used_time;
-    // long total = msg_count == 0 ? 1 : msg_count - send_count -
-    // opts->parallel; printf("total: %ld, rate: %lf(msg/sec)\n", total,
-    //        (total * 1000.0 / used_time));
+// Per-second reporting shared by the plain run and --find-max.
+struct reporter {
+    client_opts *         opts;
+    struct hdr_histogram *prev;
+    struct hdr_histogram *interval;
+    struct hdr_log        log;
+    nng_time              start;
+    double                wall_last;
+    long                  last_done;
+    long                  last_recv;
+    struct hdr_histogram *run_base; // latency at the start of the run
+    struct hdr_histogram *run;
+    struct profile_report prof;
+};
 
-    nng_free(works, sizeof(struct work *) * opts->parallel);
-    client_stop(argc, argv);
+static void reporter_init(struct reporter *r, client_opts *opts)
+{
+    int rv;
+
+    memset(r, 0, sizeof(*r));
+    r->opts = opts;
+    if ((rv = hdr_init(1, LATENCY_MAX_US, 3, &latency)) != 0 ||
+        (rv = hdr_init(1, LATENCY_MAX_US, 3, &r->prev)) != 0 ||
+        (rv = hdr_init(1, LATENCY_MAX_US, 3, &r->interval)) != 0 ||
+        (rv = hdr_init(1, LATENCY_MAX_US, 3, &r->run_base)) != 0 ||
+        (rv = hdr_init(1, LATENCY_MAX_US, 3, &r->run)) != 0) {
+        nng_fatal("hdr_init", rv);
+    }
+
+    r->start     = nng_clock();
+    r->wall_last = wall_clock();
+
+    wall_offset_us =
+        (int64_t)(r->wall_last * 1e6) - (int64_t) bench_clock_us();
+
+    if (opts->hdr_log &&
+        (rv = hdr_log_open(&r->log, opts->hdr_log, r->wall_last)) != 0) {
+        fatal("Cannot open file %s: %s", opts->hdr_log, strerror(rv));
+    }
 }
 
-void client_stop(int argc, char **argv)
+static void reporter_tick(struct reporter *r)
 {
-    if (opts) {
-        if (opts->url) {
-            nng_strfree(opts->url);
-        }
-        if (opts->topic) {
-            freetopic(opts->topic);
-        }
-        if (opts->user) {
-            nng_strfree(opts->user);
+    client_opts *opts      = r->opts;
+    nng_time     used_time = nng_clock() - r->start;
+    double       wall_now  = wall_clock();
+    long         total;
+
+    hdr_take_interval(latency, r->prev, r->interval);
+    if (r->log.f) {
+        hdr_log_write(&r->log, r->wall_last, wall_now, r->interval);
+    }
+    r->wall_last = wall_now;
+
+    if (opts->conns > 1 && launcher_ramping(&launcher)) {
+        launcher_print_ramp(&launcher);
+    }
+
+    switch (opts->type) {
+    case PUB:
+        total = send_done;
+        printf("sent total: %ld, rate: %ld(msg/sec), time: %ldms\n", total,
+               total - r->last_done, used_time);
+        r->last_done = total;
+        print_latency("interval", r->interval);
+        break;
+
+    case SUB:
+        total = recv_count;
+        if (r->last_recv != total) {
+            printf("recv total: %ld, rate: %ld(msg/sec), time: %ld\n", total,
+                   total - r->last_recv, used_time);
+            r->last_recv = total;
+            print_latency("interval", r->interval);
         }
-        if (opts->passwd) {
-            nng_strfree(opts->passwd);
+        if (opts->consumer.queue_len > 0) {
+            print_consumer();
         }
-        if (opts->client_id) {
-            nng_strfree(opts->client_id);
+        if (opts->checksum) {
+            print_verify();
         }
-        if (opts->msg) {
-            nng_free(opts->msg, opts->msg_len);
+        break;
+
+    default:
+        break;
+    }
+}
+
+// Flushes whatever was recorded after the last tick.
+static void reporter_fini(struct reporter *r)
+{
+    hdr_take_interval(latency, r->prev, r->interval);
+    if (r->log.f) {
+        if (hdr_count(r->interval) > 0) {
+            hdr_log_write(&r->log, r->wall_last, wall_clock(), r->interval);
         }
-        if (opts->will_msg) {
-            nng_free(opts->will_msg, opts->will_msg_len);
+        hdr_log_close(&r->log);
+    }
+    hdr_close(r->run);
+    hdr_close(r->run_base);
+    hdr_close(r->interval);
+    hdr_close(r->prev);
+}
+
+// Starts a measured run. Publishers must be idle; a subscriber keeps
+// receiving, so a message may land on either side of the boundary.
+// Latency is not reset but taken as the difference to run_base, which
+// keeps the per-second intervals intact.
+static void reporter_run_begin(struct reporter *r)
+{
+    hdr_take_interval(latency, r->run_base, r->run);
+    send_finished = 0;
+    send_done     = 0;
+    send_errors   = 0;
+    recv_count    = 0;
+    first_us      = 0;
+    last_us       = 0;
+    r->last_done  = 0;
+    r->last_recv  = 0;
+    r->start      = nng_clock();
+    conn_stats_reset(conn_stats, r->opts->conns);
+    if (profile != NULL) {
+        profile_begin(profile);
+    }
+}
+
+static void reporter_run_end(struct reporter *r, struct run_result *res)
+{
+    uint64_t elapsed = last_us > first_us ? last_us - first_us : 0;
+
+    hdr_take_interval(latency, r->run_base, r->run);
+    memset(res, 0, sizeof(*res));
+    res->total   = r->opts->type == PUB ? send_done : recv_count;
+    res->errors  = send_errors;
+    res->elapsed = elapsed / 1e6;
+    res->rate    = elapsed > 0 ? res->total * 1e6 / elapsed : 0;
+    run_result_latency(res, r->run);
+    if (r->opts->conns > 1) {
+        struct fairness f;
+        fairness_compute(conn_stats, r->opts->conns, res->elapsed, &f);
+        res->conns       = f.n;
+        res->conn_min    = f.min;
+        res->conn_median = f.median;
+        res->conn_max    = f.max;
+        res->jain        = f.jain;
+    }
+    if (profile != NULL) {
+        profile_end(profile, &r->prof);
+        res->profiled    = true;
+        res->cpu_util    = r->prof.util;
+        res->thread_util = r->prof.thread_util;
+        res->bench_bound = r->prof.bench_bound;
+        if (r->prof.perf && res->total > 0) {
+            res->cycles_per_msg =
+                (double) r->prof.counters[COUNTER_CYCLES] / res->total;
         }
-        if (opts->will_topic) {
-            nng_strfree(opts->will_topic);
+    }
+}
+
+static void reporter_print_run(struct reporter *r,
+                               const struct run_result *res)
+{
+    client_opts *opts = r->opts;
+
+    print_summary(opts);
+    print_latency("total", r->run);
+    if (opts->conns > 1) {
+        fairness_print(conn_stats, opts->conns, res->elapsed, opts->client_id,
+                       opts->worst);
+    }
+    if (profile != NULL) {
+        profile_print(&r->prof, res->total);
+    }
+}
+
+// Reports every second until the run is over: a --count run ends with
+// its last completion, any other after --duration seconds.
+static void run_wait(struct reporter *r)
+{
+    client_opts *opts = r->opts;
+    nng_time     end  = nng_clock() + (nng_time) opts->duration * 1000;
+
+    while (!exit_signal) {
+        // Wake up early when a --count run completes mid-interval.
+        for (int i = 0; i < 10 && !exit_signal; i++) {
+            nng_msleep(100);
+            if (opts->duration > 0 && nng_clock() >= end) {
+                exit_signal = true;
+            }
         }
-        if (opts->cacert) {
-            nng_free(opts->cacert, opts->cacert_len);
+        reporter_tick(r);
+    }
+    // Sends still in flight belong to this run. Each completes within
+    // SEND_TIMEOUT_MS, and a pending pacing sleep within one interval.
+    while (pub_active > 0) {
+        nng_msleep(1);
+    }
+}
+
+// Sets the offered rate across all lanes and restarts their schedules,
+// so that a backlog from a previous rate is not carried over.
+static void set_rate(struct lane *lanes, size_t nlanes, uint64_t rate)
+{
+    uint64_t now = bench_clock_us() * 1000;
+
+    interval_ns = rate > 0 ? nlanes * 1000000000ULL / rate : 0;
+    for (size_t i = 0; i < nlanes; i++) {
+        lanes[i].next_due = now;
+    }
+}
+
+static void schedule_start(client_opts *opts, struct lane *lanes,
+                           size_t nlanes)
+{
+    uint64_t now = bench_clock_us() * 1000;
+
+    if (opts->rate > 0) {
+        set_rate(lanes, nlanes, opts->rate);
+        return;
+    }
+    interval_ns = opts->interval * 1000000ULL;
+    for (size_t i = 0; i < nlanes; i++) {
+        lanes[i].next_due = now;
+    }
+}
+
+struct step {
+    uint64_t offered;
+    double   achieved;
+    int64_t  p50;
+    int64_t  p99;
+    double   loss;
+    bool     pass;
+};
+
+static void run_step(struct reporter *r, struct lane *lanes, size_t nlanes,
+                     struct hdr_histogram *window, struct step *st)
+{
+    client_opts *opts  = r->opts;
+    long         done0 = send_done;
+    uint64_t     t0    = bench_clock_us();
+    uint64_t     elapsed;
+    double       offered;
+
+    printf("find-max: offering %lu(msg/sec) for %us\n", st->offered,
+           opts->step_time);
+    set_rate(lanes, nlanes, st->offered);
+    hdr_reset(window);
+    for (uint32_t i = 0; i < opts->step_time && !exit_signal; i++) {
+        nng_msleep(1000);
+        reporter_tick(r);
+        hdr_add(window, r->interval);
+    }
+
+    elapsed      = bench_clock_us() - t0;
+    offered      = st->offered * (elapsed / 1e6);
+    st->achieved = (send_done - done0) * 1e6 / elapsed;
+    st->loss     = offered > 0
+            ? (offered - (send_done - done0)) * 100.0 / offered
+            : 0;
+    st->loss = st->loss < 0 ? 0 : st->loss;
+    st->p50  = hdr_value_at_percentile(window, 50.0);
+    st->p99  = hdr_value_at_percentile(window, 99.0);
+    st->pass = hdr_count(window) > 0 && st->p99 <= opts->slo_p99 &&
+        st->loss <= opts->slo_loss;
+}
+
+#define FIND_MAX_STEPS 32
+
+// When nothing has passed yet, the search gives up after this many
+// halvings of the failing rate, or below 1 msg/sec: a broker that fails
+// the SLO at a sixteenth of the starting rate is not worth bisecting
+// towards zero.
+#define FIND_MAX_HALVINGS 4
+
+// Doubles the offered rate while the SLO holds, then bisects between the
+// last rate that met it and the first that did not, down to 5%.
+static void find_max(struct reporter *r, struct lane *lanes, size_t nlanes)
+{
+    client_opts *         opts = r->opts;
+    struct step           steps[FIND_MAX_STEPS];
+    struct hdr_histogram *window;
+    size_t                n        = 0;
+    uint64_t              rate     = opts->rate;
+    uint64_t              lo       = 0;
+    uint64_t              hi       = 0;
+    int                   halvings = 0;
+    int                   rv;
+
+    if ((rv = hdr_init(1, LATENCY_MAX_US, 3, &window)) != 0) {
+        nng_fatal("hdr_init", rv);
+    }
+
+    while (n < FIND_MAX_STEPS && !exit_signal) {
+        struct step *st = &steps[n++];
+
+        st->offered = rate;
+        run_step(r, lanes, nlanes, window, st);
+        if (st->pass) {
+            lo = rate;
+        } else {
+            hi = rate;
         }
-        if (opts->cert) {
-            nng_free(opts->cert, opts->cert_len);
+
+        if (hi == 0) {
+            if (rate >= opts->max_rate) {
+                break;
+            }
+            rate = rate * 2 < opts->max_rate ? rate * 2 : opts->max_rate;
+        } else {
+            if (lo == 0 &&
+                (++halvings > FIND_MAX_HALVINGS || hi / 2 < 1)) {
+                break;
+            }
+            if (hi - lo <= (lo / 20 > 1 ? lo / 20 : 1)) {
+                break;
+            }
+            rate = (lo + hi) / 2;
         }
-        if (opts->key) {
-            nng_free(opts->key, opts->key_len);
+    }
+    hdr_close(window);
+
+    printf("\n%12s %12s %10s %10s %8s %s\n", "offered", "achieved", "p50(us)",
+           "p99(us)", "loss(%)", "slo");
+    for (size_t i = 0; i < n; i++) {
+        printf("%12lu %12.1f %10ld %10ld %8.3f %s\n", steps[i].offered,
+               steps[i].achieved, steps[i].p50, steps[i].p99, steps[i].loss,
+               steps[i].pass ? "pass" : "FAIL");
+    }
+    if (lo > 0) {
+        printf("max sustainable rate: %lu(msg/sec) at p99 <= %uus, "
+               "loss <= %.3f%%\n",
+               lo, opts->slo_p99, opts->slo_loss);
+    } else {
+        printf("max sustainable rate: none, no passing rate down to "
+               "%lu(msg/sec)\n",
+               steps[n - 1].offered);
+    }
+    exit_signal = true;
+}
+
+void client(int argc, char **argv, enum client_type type)
+{
+    int rv;
+
+    arena_init(&arena, ARENA_CHUNK_SIZE);
+    if ((opts = arena_alloc(&arena, sizeof(client_opts), sizeof(void *))) ==
+        NULL) {
+        nng_fatal("arena_alloc", NNG_ENOMEM);
+    }
+    set_default_conf(opts);
+    opts->type = type;
+
+    client_parse_opts(argc, argv, opts);
+    connect_cfg_init(opts);
+
+    send_budget = opts->msg_count;
+    recv_start  = nng_clock();
+    crc32c_init();
+    if (opts->checksum && opts->verbose) {
+        printf("crc32c: %s\n", crc32c_impl());
+    }
+
+    // Before any thread is started, so that the counters follow them all.
+    if (opts->profile && (rv = profile_init(&profile)) != 0) {
+        nng_fatal("profile_init", rv);
+    }
+    if (opts->type != PUB &&
+        (rv = consumer_init(&consumer, &opts->consumer)) != 0) {
+        nng_fatal("consumer_init", rv);
+    }
+
+    if (opts->type != PUB) {
+        opts->pipeline = 1;
+    }
+
+    // nng MQTT contexts carry a single pending send each, so every
+    // pipeline slot gets its own context on its lane's connection.
+    size_t       nlanes  = opts->conns * opts->parallel;
+    size_t       nworks  = nlanes * opts->pipeline;
+    uint64_t     startup = bench_clock_us();
+    size_t       used    = arena.used;
+    struct conn *conns   = arena_alloc(
+        &arena, sizeof(struct conn) * opts->conns, ARENA_CACHE_LINE);
+    struct work *works =
+        arena_alloc(&arena, sizeof(struct work) * nworks, ARENA_CACHE_LINE);
+    struct lane *lanes =
+        arena_alloc(&arena, sizeof(struct lane) * nlanes, ARENA_CACHE_LINE);
+
+    conn_stats = arena_alloc(&arena, sizeof(struct conn_stats) * opts->conns,
+                             ARENA_CACHE_LINE);
+    if (conns == NULL || works == NULL || lanes == NULL ||
+        conn_stats == NULL) {
+        nng_fatal("arena_alloc", NNG_ENOMEM);
+    }
+    used = arena.used - used;
+
+    for (int i = 0; i < AUTH_COUNT; i++) {
+        if ((rv = hdr_init(1, LATENCY_MAX_US, 3, &connack_latency[i])) != 0) {
+            nng_fatal("hdr_init", rv);
         }
-        if (opts->keypass) {
-            nng_strfree(opts->keypass);
+    }
+
+    struct conn_set set = {
+        .opts  = opts,
+        .conns = conns,
+        .works = works,
+        .lanes = lanes,
+    };
+    if ((rv = launcher_init(&launcher, &opts->launch, opts->conns,
+                            conn_setup, conn_dial, &set)) != 0) {
+        nng_fatal("launcher_init", rv);
+    }
+    launcher_run(&launcher);
+    // nng's own socket, dialer and aio state is not included.
+    printf("dialed %zu connections, %zu contexts in %.3fs, client state: "
+           "%zu bytes per connection, %zu bytes total\n",
+           opts->conns, nworks, (bench_clock_us() - startup) / 1e6,
+           used / opts->conns, arena.reserved);
+
+    struct reporter    rep;
+    struct run_result *runs =
+        arena_alloc(&arena, sizeof(*runs) * opts->repeat, sizeof(double));
+
+    if (runs == NULL) {
+        nng_fatal("arena_alloc", NNG_ENOMEM);
+    }
+    reporter_init(&rep, opts);
+    reporter_run_begin(&rep);
+
+    schedule_start(opts, lanes, nlanes);
+    for (size_t i = 0; i < nworks; i++) {
+        client_cb(&works[i]);
+    }
+
+    if (opts->find_max) {
+        find_max(&rep, lanes, nlanes);
+        reporter_run_end(&rep, &runs[0]);
+        reporter_print_run(&rep, &runs[0]);
+    } else {
+        for (uint32_t run = 0; run < opts->repeat; run++) {
+            if (run > 0) {
+                // Publishers have all retired; restart them on a fresh
+                // schedule and budget.
+                exit_signal = false;
+                send_budget = opts->msg_count;
+                reporter_run_begin(&rep);
+                if (opts->type == PUB) {
+                    schedule_start(opts, lanes, nlanes);
+                    for (size_t i = 0; i < nworks; i++) {
+                        pub_active++;
+                        send_next(&works[i]);
+                    }
+                }
+            }
+            run_wait(&rep);
+            reporter_run_end(&rep, &runs[run]);
+            if (opts->repeat > 1) {
+                printf("run %u/%u: ", run + 1, opts->repeat);
+            }
+            reporter_print_run(&rep, &runs[run]);
         }
+    }
 
-        free(opts);
+    reporter_fini(&rep);
+    client_teardown(conns, opts->conns, works, nworks);
+    // Publishers read records until their aios are stopped.
+    corpus_close(&opts->corpus);
+    // Receives have stopped; let the queue drain before it is counted.
+    if (consumer != NULL) {
+        consumer_stop(consumer);
+    }
+    print_connack();
+    if (opts->conns > 1) {
+        launcher_print_milestones(&launcher);
+    }
+    print_consumer();
+    if (opts->type == SUB && opts->checksum) {
+        print_verify();
+    }
+    if (!opts->find_max && opts->repeat > 1) {
+        results_print_aggregate(runs, opts->repeat);
+    }
+    if (opts->json) {
+        results_write(opts->json, opts->type == PUB ? "pub" : "sub",
+                      opts->url, runs, opts->repeat);
+    }
+
+    if (consumer != NULL) {
+        consumer_fini(consumer);
+        consumer = NULL;
+    }
+    profile_fini(profile);
+    hdr_close(latency);
+    for (int i = 0; i < AUTH_COUNT; i++) {
+        hdr_close(connack_latency[i]);
+    }
+    client_stop(argc, argv);
+}
+
+void client_stop(int argc, char **argv)
+{
+    if (opts) {
+        credentials_fini(&opts->creds);
+        opts = NULL;
     }
+    arena_fini(&arena);
 }
@@ -1,8 +1,13 @@
 #ifndef MQTT_BENCH_H
 #define MQTT_BENCH_H
 
+#include <stdint.h>
+
 #define APP_NAME "nng-mqtt-bench"
 
+// Upper bound of the latency histograms (us).
+#define LATENCY_MAX_US (60LL * 1000 * 1000)
+
 enum client_type
 {
     PUB,
@@ -10,7 +15,9 @@ enum client_type
     CONN
 };
 
-void fatal(const char *msg, ...);
-void client(int argc, char **argv, enum client_type type);
+void     fatal(const char *msg, ...);
+uint64_t bench_clock_us(void);
+void     client(int argc, char **argv, enum client_type type);
+void     compare(int argc, char **argv);
 
 #endif
@@ -0,0 +1,183 @@
+#include "checksum.h"
+#include "byteorder.h"
+
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#endif
+
+#define CRC32C_POLY 0x82f63b78 // reflected Castagnoli polynomial
+
+static uint32_t crc_table[8][256];
+
+static uint32_t (*crc_fn)(uint32_t, const uint8_t *, size_t);
+static const char *crc_name;
+
+// Portable slicing-by-8, eight bytes per step.
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t *p, size_t len)
+{
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        v ^= crc;
+        crc = crc_table[7][v & 0xff] ^ crc_table[6][(v >> 8) & 0xff] ^
+            crc_table[5][(v >> 16) & 0xff] ^ crc_table[4][(v >> 24) & 0xff] ^
+            crc_table[3][(v >> 32) & 0xff] ^ crc_table[2][(v >> 40) & 0xff] ^
+            crc_table[1][(v >> 48) & 0xff] ^ crc_table[0][v >> 56];
+        p += 8;
+        len -= 8;
+    }
+    while (len-- > 0) {
+        crc = crc_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+#define SSE42_BLOCK 256
+
+// Advances a CRC register over SSE42_BLOCK zero bytes, by byte lanes.
+static uint32_t crc_shift_table[4][256];
+
+static uint32_t crc32c_shift(uint32_t crc)
+{
+    return crc_shift_table[0][crc & 0xff] ^
+        crc_shift_table[1][(crc >> 8) & 0xff] ^
+        crc_shift_table[2][(crc >> 16) & 0xff] ^ crc_shift_table[3][crc >> 24];
+}
+
+// SSE4.2 crc32: three independent streams over three adjacent blocks
+// hide the three cycle latency of the instruction. The streams are
+// joined with the shift table, as the register is linear in its input.
+__attribute__((target("sse4.2"))) static uint32_t
+crc32c_sse42(uint32_t crc, const uint8_t *p, size_t len)
+{
+    const size_t block = SSE42_BLOCK;
+    uint64_t     c0    = crc;
+
+    while (len >= 3 * block) {
+        uint64_t c1 = 0;
+        uint64_t c2 = 0;
+        for (size_t i = 0; i < block; i += 8) {
+            uint64_t v0, v1, v2;
+            memcpy(&v0, p + i, 8);
+            memcpy(&v1, p + block + i, 8);
+            memcpy(&v2, p + 2 * block + i, 8);
+            c0 = _mm_crc32_u64(c0, v0);
+            c1 = _mm_crc32_u64(c1, v1);
+            c2 = _mm_crc32_u64(c2, v2);
+        }
+        c0 = crc32c_shift((uint32_t) c0) ^ c1;
+        c0 = crc32c_shift((uint32_t) c0) ^ c2;
+        p += 3 * block;
+        len -= 3 * block;
+    }
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        c0 = _mm_crc32_u64(c0, v);
+        p += 8;
+        len -= 8;
+    }
+    while (len-- > 0) {
+        c0 = _mm_crc32_u8((uint32_t) c0, *p++);
+    }
+    return (uint32_t) c0;
+}
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+static uint32_t crc32c_armv8(uint32_t crc, const uint8_t *p, size_t len)
+{
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        crc = __crc32cd(crc, v);
+        p += 8;
+        len -= 8;
+    }
+    while (len-- > 0) {
+        crc = __crc32cb(crc, *p++);
+    }
+    return crc;
+}
+#endif
+
+void crc32c_init(void)
+{
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+        }
+        crc_table[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+        for (int t = 1; t < 8; t++) {
+            crc_table[t][i] = (crc_table[t - 1][i] >> 8) ^
+                crc_table[0][crc_table[t - 1][i] & 0xff];
+        }
+    }
+
+    crc_fn   = crc32c_sw;
+    crc_name = "table";
+#if defined(__x86_64__)
+    static const uint8_t zeros[SSE42_BLOCK];
+    for (int k = 0; k < 4; k++) {
+        for (uint32_t v = 0; v < 256; v++) {
+            crc_shift_table[k][v] =
+                crc32c_sw(v << (8 * k), zeros, sizeof(zeros));
+        }
+    }
+    if (__builtin_cpu_supports("sse4.2")) {
+        crc_fn   = crc32c_sse42;
+        crc_name = "sse4.2";
+    }
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+    crc_fn   = crc32c_armv8;
+    crc_name = "armv8-crc";
+#endif
+}
+
+const char *crc32c_impl(void)
+{
+    return crc_name;
+}
+
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len)
+{
+    return ~crc_fn(~crc, buf, len);
+}
+
+// Writes the trailer into the last CHECKSUM_TRAILER_SIZE bytes of the
+// len bytes at payload.
+void checksum_seal(uint8_t *payload, size_t len)
+{
+    size_t body = len - CHECKSUM_TRAILER_SIZE;
+
+    put_be32(payload + body, (uint32_t) body);
+    put_be32(payload + body + 4, crc32c(0, payload, body));
+}
+
+// A trailer whose length disagrees with the payload means bytes went
+// missing (or were added); a matching length with a bad CRC means they
+// were changed.
+enum checksum_result checksum_verify(const uint8_t *payload, size_t len)
+{
+    size_t body;
+
+    if (payload == NULL || len < CHECKSUM_TRAILER_SIZE) {
+        return CHECKSUM_TRUNCATED;
+    }
+    body = len - CHECKSUM_TRAILER_SIZE;
+    if (get_be32(payload + body) != body) {
+        return CHECKSUM_TRUNCATED;
+    }
+    if (get_be32(payload + body + 4) != crc32c(0, payload, body)) {
+        return CHECKSUM_CORRUPT;
+    }
+    return CHECKSUM_OK;
+}
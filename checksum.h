@@ -0,0 +1,26 @@
+#ifndef MQTT_BENCH_CHECKSUM_H
+#define MQTT_BENCH_CHECKSUM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Trailer appended to the payload with --checksum: the number of payload
+// bytes before the trailer and their CRC32C, both big-endian.
+#define CHECKSUM_TRAILER_SIZE 8
+
+enum checksum_result {
+    CHECKSUM_OK,
+    CHECKSUM_CORRUPT,
+    CHECKSUM_TRUNCATED,
+};
+
+// Picks the fastest CRC32C implementation for this CPU. Must be called
+// once before any other function here, while still single threaded.
+void        crc32c_init(void);
+const char *crc32c_impl(void);
+uint32_t    crc32c(uint32_t crc, const void *buf, size_t len);
+
+void                 checksum_seal(uint8_t *payload, size_t len);
+enum checksum_result checksum_verify(const uint8_t *payload, size_t len);
+
+#endif
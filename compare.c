@@ -0,0 +1,222 @@
+#include "bench.h"
+#include "results.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void compare_usage(void)
+{
+    fatal("Usage: " APP_NAME
+          " compare <base.json> <new.json> [--threshold <pct>]\n"
+          "       " APP_NAME " compare --table <file.json>...\n\n"
+          "Compares the runs in two --json result files. Exits with status 1\n"
+          "when throughput or a latency percentile got worse by more than\n"
+          "the threshold (default 5%%) and the 95%% confidence interval of\n"
+          "the difference excludes zero.\n\n"
+          "With --table, lists any number of result files side by side, e.g.\n"
+          "the same scenario run once per transport.");
+}
+
+// Welch's approximation of the degrees of freedom of a difference of
+// two means with unequal variances.
+static double welch_df(const struct run_stats *a, const struct run_stats *b)
+{
+    double va = a->sd * a->sd / a->n;
+    double vb = b->sd * b->sd / b->n;
+
+    if (va + vb == 0) {
+        return a->n + b->n - 2;
+    }
+    return (va + vb) * (va + vb) /
+        (va * va / (a->n - 1) + vb * vb / (b->n - 1));
+}
+
+// A saturated client caps throughput on its own, so a delta measured on
+// such runs says little about the broker.
+static void warn_bench_bound(const char *path, const struct run_result *runs,
+                             size_t n)
+{
+    size_t bound = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        bound += runs[i].bench_bound;
+    }
+    if (bound > 0) {
+        printf("warning: %zu of %zu runs in %s were bench-bound\n", bound, n,
+               path);
+    }
+}
+
+// The transport is the url scheme, e.g. "mqtt-quic".
+static void url_scheme(const char *url, char *buf, size_t len)
+{
+    const char *end = strstr(url, "://");
+    size_t      n   = end != NULL ? (size_t)(end - url) : strlen(url);
+
+    if (n == 0) {
+        snprintf(buf, len, "-");
+        return;
+    }
+    snprintf(buf, len, "%.*s", (int) n, url);
+}
+
+// One row per file; the rate is also given relative to the first file.
+static void compare_table(int argc, char **argv)
+{
+    double first = 0;
+
+    if (argc < 1) {
+        compare_usage();
+    }
+    printf("%-16s %5s %24s %9s %10s %10s %10s  %s\n", "transport", "runs",
+           "rate(msg/sec)", "vs 1st(%)", "p50(us)", "p99(us)", "p99.9(us)",
+           "file");
+    for (int i = 0; i < argc; i++) {
+        struct run_result *runs;
+        size_t             n;
+        char               url[256];
+        char               scheme[32];
+        char               rate[32];
+        char               delta[16];
+        struct run_stats   st;
+        struct run_stats   p50;
+        struct run_stats   p99;
+        struct run_stats   p999;
+        size_t             bound = 0;
+
+        results_load(argv[i], url, sizeof(url), &runs, &n);
+        url_scheme(url, scheme, sizeof(scheme));
+        run_stats(runs, n, METRIC_RATE, &st);
+        run_stats(runs, n, METRIC_P50, &p50);
+        run_stats(runs, n, METRIC_P99, &p99);
+        run_stats(runs, n, METRIC_P999, &p999);
+        for (size_t k = 0; k < n; k++) {
+            bound += runs[k].bench_bound;
+        }
+
+        if (n >= 2) {
+            snprintf(rate, sizeof(rate), "%.1f +/-%.1f", st.mean, st.ci);
+        } else {
+            snprintf(rate, sizeof(rate), "%.1f", st.mean);
+        }
+        if (i == 0) {
+            first = st.mean;
+            snprintf(delta, sizeof(delta), "-");
+        } else if (first == 0) {
+            snprintf(delta, sizeof(delta), "n/a");
+        } else {
+            snprintf(delta, sizeof(delta), "%+.2f",
+                     (st.mean - first) * 100.0 / first);
+        }
+        printf("%-16s %5zu %24s %9s %10.1f %10.1f %10.1f  %s%s\n", scheme, n,
+               rate, delta, p50.mean, p99.mean, p999.mean, argv[i],
+               bound > 0 ? " (bench-bound)" : "");
+        results_free(runs, n);
+    }
+    exit(0);
+}
+
+void compare(int argc, char **argv)
+{
+    static const struct {
+        enum run_metric m;
+        const char *    name;
+        bool            higher_better;
+    } metrics[] = {
+        { METRIC_RATE, "rate(msg/sec)", true },
+        { METRIC_P50, "p50(us)", false },
+        { METRIC_P99, "p99(us)", false },
+        { METRIC_P999, "p99.9(us)", false },
+    };
+    struct run_result *base;
+    struct run_result *cand;
+    size_t             nbase;
+    size_t             ncand;
+    double             threshold = 5.0;
+    bool               failed    = false;
+
+    if (argc >= 1 && strcmp(argv[0], "--table") == 0) {
+        compare_table(argc - 1, argv + 1);
+    }
+    if (argc < 2) {
+        compare_usage();
+    }
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+            char *end;
+            threshold = strtod(argv[++i], &end);
+            if (*end != '\0' || threshold < 0) {
+                fatal("Invalid threshold %s", argv[i]);
+            }
+        } else {
+            compare_usage();
+        }
+    }
+
+    results_load(argv[0], NULL, 0, &base, &nbase);
+    results_load(argv[1], NULL, 0, &cand, &ncand);
+
+    printf("base: %s (%zu runs), new: %s (%zu runs), threshold: %.1f%%\n\n",
+           argv[0], nbase, argv[1], ncand, threshold);
+    printf("%-14s %14s %14s %9s %10s  %s\n", "metric", "base", "new",
+           "delta(%)", "ci(%)", "verdict");
+
+    for (size_t i = 0; i < sizeof(metrics) / sizeof(metrics[0]); i++) {
+        struct run_stats sb;
+        struct run_stats sn;
+        double           delta;
+        double           ci = NAN;
+        bool             worse;
+        bool             significant = true;
+        const char *     verdict;
+
+        run_stats(base, nbase, metrics[i].m, &sb);
+        run_stats(cand, ncand, metrics[i].m, &sn);
+        if (sb.mean == 0) {
+            printf("%-14s %14.1f %14.1f %9s %10s  %s\n", metrics[i].name,
+                   sb.mean, sn.mean, "-", "-", "no data");
+            continue;
+        }
+        delta = (sn.mean - sb.mean) * 100.0 / sb.mean;
+
+        // With a single run on either side there is no variance to go by,
+        // so the threshold alone decides.
+        if (sb.n >= 2 && sn.n >= 2) {
+            double se = sqrt(sb.sd * sb.sd / sb.n + sn.sd * sn.sd / sn.n);
+            ci        = t_critical(welch_df(&sb, &sn)) * se * 100.0 / sb.mean;
+            significant = fabs(delta) > ci;
+        }
+
+        worse = metrics[i].higher_better ? delta < -threshold
+                                         : delta > threshold;
+        if (worse && significant) {
+            verdict = "REGRESSION";
+            failed  = true;
+        } else if (!significant) {
+            verdict = "within noise";
+        } else if (metrics[i].higher_better ? delta > threshold
+                                            : delta < -threshold) {
+            verdict = "improved";
+        } else {
+            verdict = "ok";
+        }
+
+        if (isnan(ci)) {
+            printf("%-14s %14.1f %14.1f %+9.2f %10s  %s\n", metrics[i].name,
+                   sb.mean, sn.mean, delta, "-", verdict);
+        } else {
+            printf("%-14s %14.1f %14.1f %+9.2f    +/-%6.2f  %s\n",
+                   metrics[i].name, sb.mean, sn.mean, delta, ci, verdict);
+        }
+    }
+
+    warn_bench_bound(argv[0], base, nbase);
+    warn_bench_bound(argv[1], cand, ncand);
+
+    results_free(base, nbase);
+    results_free(cand, ncand);
+    exit(failed ? 1 : 0);
+}
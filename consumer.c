@@ -0,0 +1,269 @@
+#include "consumer.h"
+#include "bench.h"
+
+#include <string.h>
+
+#include <nng/mqtt/mqtt_client.h>
+
+// Keeps the simulated work from being optimized away.
+static atomic_uint_fast64_t sink;
+
+static void process(const struct consumer_cfg *cfg, nng_msg *msg)
+{
+    uint32_t len;
+    uint8_t *payload;
+
+    if (cfg->hash &&
+        nng_mqtt_msg_get_packet_type(msg) == NNG_MQTT_PUBLISH &&
+        (payload = nng_mqtt_msg_get_publish_payload(msg, &len)) != NULL) {
+        // FNV-1a, byte at a time on purpose: it stands in for a parser.
+        uint64_t h = 0xcbf29ce484222325ULL;
+        for (uint32_t i = 0; i < len; i++) {
+            h ^= payload[i];
+            h *= 0x100000001b3ULL;
+        }
+        atomic_fetch_xor_explicit(&sink, h, memory_order_relaxed);
+    }
+    if (cfg->busy_us > 0) {
+        uint64_t until = bench_clock_us() + cfg->busy_us;
+        while (bench_clock_us() < until) {
+        }
+    }
+}
+
+// Takes the oldest waiter off the list; called with the lock held.
+static nng_aio *waiter_pop(struct consumer *c)
+{
+    nng_aio *aio;
+
+    if (c->nwaiters == 0) {
+        return NULL;
+    }
+    aio = c->waiters[0];
+    c->nwaiters--;
+    memmove(c->waiters, c->waiters + 1, sizeof(nng_aio *) * c->nwaiters);
+    return aio;
+}
+
+static void consumer_thread(void *arg)
+{
+    struct consumer *c = arg;
+    nng_msg *        msg;
+    nng_aio *        waiter;
+
+    nng_mtx_lock(c->mtx);
+    for (;;) {
+        while (c->count == 0 && !c->closed) {
+            nng_cv_wait(c->cv);
+        }
+        if (c->count == 0) {
+            break;
+        }
+        msg     = c->ring[c->head];
+        c->head = (c->head + 1) % c->cfg.queue_len;
+        c->count--;
+        waiter = waiter_pop(c);
+        nng_mtx_unlock(c->mtx);
+
+        // There is room for one more message now.
+        if (waiter != NULL) {
+            nng_aio_finish(waiter, 0);
+        }
+        consumer_handle(c, msg);
+
+        nng_mtx_lock(c->mtx);
+    }
+    nng_mtx_unlock(c->mtx);
+}
+
+int consumer_init(struct consumer **cp, const struct consumer_cfg *cfg)
+{
+    struct consumer *c;
+    int              rv;
+
+    if ((c = nng_alloc(sizeof(*c))) == NULL) {
+        return (NNG_ENOMEM);
+    }
+    memset(c, 0, sizeof(*c));
+    c->cfg = *cfg;
+    if (c->cfg.queue_len > 0 && c->cfg.threads == 0) {
+        c->cfg.threads = 1;
+    }
+    atomic_init(&c->processed, 0);
+    atomic_init(&c->dropped, 0);
+
+    if ((rv = nng_mtx_alloc(&c->mtx)) != 0 ||
+        (rv = nng_cv_alloc(&c->cv, c->mtx)) != 0) {
+        consumer_fini(c);
+        return (rv);
+    }
+    if (c->cfg.queue_len == 0) {
+        *cp = c;
+        return (0);
+    }
+
+    if ((c->ring = nng_alloc(sizeof(nng_msg *) * c->cfg.queue_len)) ==
+            NULL ||
+        (c->threads = nng_alloc(sizeof(nng_thread *) * c->cfg.threads)) ==
+            NULL) {
+        consumer_fini(c);
+        return (NNG_ENOMEM);
+    }
+    memset(c->threads, 0, sizeof(nng_thread *) * c->cfg.threads);
+    for (size_t i = 0; i < c->cfg.threads; i++) {
+        if ((rv = nng_thread_create(&c->threads[i], consumer_thread, c)) !=
+            0) {
+            consumer_fini(c);
+            return (rv);
+        }
+    }
+    *cp = c;
+    return (0);
+}
+
+// Stops taking messages and waits for the consumer threads to drain the
+// queue, so that every queued message is processed and counted. Pending
+// consumer_wait() calls fail with NNG_ECLOSED. The statistics stay
+// readable until consumer_fini().
+void consumer_stop(struct consumer *c)
+{
+    nng_aio *aio;
+
+    if (c->mtx != NULL && c->cv != NULL) {
+        nng_mtx_lock(c->mtx);
+        c->closed = true;
+        nng_cv_wake(c->cv);
+        while ((aio = waiter_pop(c)) != NULL) {
+            nng_mtx_unlock(c->mtx);
+            nng_aio_finish(aio, NNG_ECLOSED);
+            nng_mtx_lock(c->mtx);
+        }
+        nng_mtx_unlock(c->mtx);
+    }
+    if (c->threads != NULL) {
+        for (size_t i = 0; i < c->cfg.threads; i++) {
+            if (c->threads[i] != NULL) {
+                nng_thread_destroy(c->threads[i]);
+            }
+        }
+        nng_free(c->threads, sizeof(nng_thread *) * c->cfg.threads);
+        c->threads = NULL;
+    }
+}
+
+void consumer_fini(struct consumer *c)
+{
+    consumer_stop(c);
+    if (c->waiters != NULL) {
+        nng_free(c->waiters, sizeof(nng_aio *) * c->waiters_cap);
+    }
+    if (c->ring != NULL) {
+        nng_free(c->ring, sizeof(nng_msg *) * c->cfg.queue_len);
+    }
+    if (c->cv != NULL) {
+        nng_cv_free(c->cv);
+    }
+    if (c->mtx != NULL) {
+        nng_mtx_free(c->mtx);
+    }
+    nng_free(c, sizeof(*c));
+}
+
+// Queues msg for the consumer threads. When the queue is full the
+// message is dropped (and freed) if so configured; otherwise NNG_EAGAIN
+// is returned and the caller keeps the message and retries later.
+int consumer_push(struct consumer *c, nng_msg *msg)
+{
+    nng_mtx_lock(c->mtx);
+    if (c->count == c->cfg.queue_len) {
+        nng_mtx_unlock(c->mtx);
+        if (c->cfg.drop) {
+            nng_msg_free(msg);
+            c->dropped++;
+            return (0);
+        }
+        return (NNG_EAGAIN);
+    }
+    c->ring[(c->head + c->count) % c->cfg.queue_len] = msg;
+    c->count++;
+    if (c->count > c->max_depth) {
+        c->max_depth = c->count;
+    }
+    nng_cv_wake1(c->cv);
+    nng_mtx_unlock(c->mtx);
+    return (0);
+}
+
+static void waiter_cancel(nng_aio *aio, void *arg, int rv)
+{
+    struct consumer *c = arg;
+
+    nng_mtx_lock(c->mtx);
+    for (size_t i = 0; i < c->nwaiters; i++) {
+        if (c->waiters[i] == aio) {
+            c->nwaiters--;
+            memmove(c->waiters + i, c->waiters + i + 1,
+                    sizeof(nng_aio *) * (c->nwaiters - i));
+            nng_mtx_unlock(c->mtx);
+            nng_aio_finish(aio, rv);
+            return;
+        }
+    }
+    nng_mtx_unlock(c->mtx);
+}
+
+// Completes aio once the queue has room for another message, so that a
+// receiver refused by consumer_push() is woken by the consumer threads
+// instead of polling.
+void consumer_wait(struct consumer *c, nng_aio *aio)
+{
+    int rv = 0;
+
+    if (!nng_aio_begin(aio)) {
+        return;
+    }
+    nng_mtx_lock(c->mtx);
+    if (c->closed) {
+        rv = NNG_ECLOSED;
+    } else if (c->count == c->cfg.queue_len) {
+        if (c->nwaiters == c->waiters_cap) {
+            size_t    cap = c->waiters_cap == 0 ? 16 : c->waiters_cap * 2;
+            nng_aio **waiters;
+            if ((waiters = nng_alloc(sizeof(nng_aio *) * cap)) == NULL) {
+                nng_mtx_unlock(c->mtx);
+                nng_aio_finish(aio, NNG_ENOMEM);
+                return;
+            }
+            if (c->waiters != NULL) {
+                memcpy(waiters, c->waiters, sizeof(nng_aio *) * c->nwaiters);
+                nng_free(c->waiters, sizeof(nng_aio *) * c->waiters_cap);
+            }
+            c->waiters     = waiters;
+            c->waiters_cap = cap;
+        }
+        c->waiters[c->nwaiters++] = aio;
+        nng_aio_defer(aio, waiter_cancel, c);
+        nng_mtx_unlock(c->mtx);
+        return;
+    }
+    nng_mtx_unlock(c->mtx);
+    nng_aio_finish(aio, rv);
+}
+
+// Processes and frees msg on the calling thread.
+void consumer_handle(struct consumer *c, nng_msg *msg)
+{
+    process(&c->cfg, msg);
+    nng_msg_free(msg);
+    c->processed++;
+}
+
+void consumer_stats(struct consumer *c, struct consumer_stats *st)
+{
+    nng_mtx_lock(c->mtx);
+    st->depth     = c->count;
+    st->max_depth = c->max_depth;
+    nng_mtx_unlock(c->mtx);
+    st->processed = c->processed;
+    st->dropped   = c->dropped;
+}
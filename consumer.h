@@ -0,0 +1,55 @@
+#ifndef MQTT_BENCH_CONSUMER_H
+#define MQTT_BENCH_CONSUMER_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <nng/nng.h>
+#include <nng/supplemental/util/platform.h>
+
+// Simulated subscriber: what it costs to handle one message, and whether
+// messages are handled on the receiving callback or handed to a bounded
+// queue drained by consumer threads.
+struct consumer_cfg {
+    uint32_t busy_us;   // spin per message
+    bool     hash;      // hash the whole payload per message
+    size_t   queue_len; // 0 handles messages inline
+    size_t   threads;
+    bool     drop;      // drop instead of blocking when the queue is full
+};
+
+struct consumer_stats {
+    size_t depth;
+    size_t max_depth;
+    long   processed;
+    long   dropped;
+};
+
+struct consumer {
+    struct consumer_cfg cfg;
+    nng_mtx *           mtx;
+    nng_cv *            cv;
+    nng_msg **          ring;
+    size_t              head;
+    size_t              count;
+    size_t              max_depth;
+    bool                closed;
+    nng_aio **          waiters; // receivers waiting for room, oldest first
+    size_t              nwaiters;
+    size_t              waiters_cap;
+    nng_thread **       threads;
+    atomic_long         processed;
+    atomic_long         dropped;
+};
+
+int  consumer_init(struct consumer **cp, const struct consumer_cfg *cfg);
+void consumer_fini(struct consumer *c);
+void consumer_stop(struct consumer *c);
+int  consumer_push(struct consumer *c, nng_msg *msg);
+void consumer_wait(struct consumer *c, nng_aio *aio);
+void consumer_handle(struct consumer *c, nng_msg *msg);
+void consumer_stats(struct consumer *c, struct consumer_stats *st);
+
+#endif
@@ -0,0 +1,124 @@
+#include "corpus.h"
+#include "byteorder.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <nng/nng.h>
+
+// Walks the records; without index it only counts them. Empty lines
+// are skipped, empty length-prefixed records are kept.
+static int corpus_scan(struct corpus *c, enum corpus_format fmt, bool index)
+{
+    const uint8_t *p   = c->data;
+    const uint8_t *end = c->data + c->len;
+    size_t         n   = 0;
+
+    while (p < end) {
+        const uint8_t *rec;
+        size_t         len;
+
+        if (fmt == CORPUS_LINES) {
+            const uint8_t *nl  = memchr(p, '\n', end - p);
+            const uint8_t *eol = nl != NULL ? nl : end;
+            rec                = p;
+            len                = eol - p;
+            if (len > 0 && rec[len - 1] == '\r') {
+                len--;
+            }
+            p = eol + (nl != NULL);
+            if (len == 0) {
+                continue;
+            }
+        } else {
+            if (end - p < 4) {
+                return (NNG_EINVAL);
+            }
+            len = get_be32(p);
+            rec = p + 4;
+            if ((size_t)(end - rec) < len) {
+                return (NNG_EINVAL);
+            }
+            p = rec + len;
+        }
+        if (len > CORPUS_RECORD_MAX) {
+            return (NNG_EINVAL);
+        }
+        if (index) {
+            c->offsets[n] = (uint64_t)(rec - c->data);
+            c->lengths[n] = (uint32_t) len;
+        }
+        n++;
+    }
+    c->count = n;
+    return (0);
+}
+
+int corpus_open(struct corpus *c, const char *path, enum corpus_format fmt)
+{
+    struct stat st;
+    void *      data;
+    int         fd;
+    int         rv;
+
+    memset(c, 0, sizeof(*c));
+    if ((fd = open(path, O_RDONLY)) < 0) {
+        return (NNG_ESYSERR | errno);
+    }
+    if (fstat(fd, &st) != 0) {
+        rv = NNG_ESYSERR | errno;
+        close(fd);
+        return (rv);
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return (NNG_EINVAL);
+    }
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    rv   = NNG_ESYSERR | errno;
+    close(fd);
+    if (data == MAP_FAILED) {
+        return (rv);
+    }
+    // Records are published in file order.
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    c->data = data;
+    c->len  = st.st_size;
+
+    if ((rv = corpus_scan(c, fmt, false)) != 0) {
+        goto fail;
+    }
+    if (c->count == 0) {
+        rv = NNG_EINVAL;
+        goto fail;
+    }
+    if ((c->offsets = nng_alloc(sizeof(uint64_t) * c->count)) == NULL ||
+        (c->lengths = nng_alloc(sizeof(uint32_t) * c->count)) == NULL) {
+        rv = NNG_ENOMEM;
+        goto fail;
+    }
+    return (corpus_scan(c, fmt, true));
+
+fail:
+    corpus_close(c);
+    return (rv);
+}
+
+void corpus_close(struct corpus *c)
+{
+    if (c->offsets != NULL) {
+        nng_free(c->offsets, sizeof(uint64_t) * c->count);
+    }
+    if (c->lengths != NULL) {
+        nng_free(c->lengths, sizeof(uint32_t) * c->count);
+    }
+    if (c->data != NULL) {
+        munmap((void *) c->data, c->len);
+    }
+    memset(c, 0, sizeof(*c));
+}
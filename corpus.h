@@ -0,0 +1,44 @@
+#ifndef MQTT_BENCH_CORPUS_H
+#define MQTT_BENCH_CORPUS_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Payloads replayed from a --corpus file. The file is mapped rather than
+// read, so a corpus of several GB costs address space and page cache
+// only; the heap holds an index of twelve bytes per record.
+enum corpus_format {
+    CORPUS_LINES, // one record per line, '\n' or "\r\n" terminated
+    CORPUS_LEN32, // each record preceded by its length, 4 bytes big-endian
+};
+
+// MQTT cannot carry a larger PUBLISH payload.
+#define CORPUS_RECORD_MAX 268435455
+
+struct corpus {
+    const uint8_t *data;
+    size_t         len;
+    uint64_t *     offsets;
+    uint32_t *     lengths;
+    size_t         count;
+    atomic_ullong  next;
+};
+
+// Returns an nng error code; NNG_EINVAL for a malformed or empty file.
+int  corpus_open(struct corpus *c, const char *path, enum corpus_format fmt);
+void corpus_close(struct corpus *c);
+
+// Successive records across all callers, wrapping around at the end. The
+// record stays valid until corpus_close().
+static inline const uint8_t *corpus_next(struct corpus *c, size_t *len)
+{
+    size_t i =
+        atomic_fetch_add_explicit(&c->next, 1, memory_order_relaxed) %
+        c->count;
+
+    *len = c->lengths[i];
+    return c->data + c->offsets[i];
+}
+
+#endif
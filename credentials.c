@@ -0,0 +1,109 @@
+#include "credentials.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <nng/nng.h>
+
+// Blank lines and lines starting with '#' are skipped. The password is
+// everything after the first ':', so it may contain colons itself; a
+// line without one has a username only.
+int credentials_parse(struct credentials *c, char *data, size_t len)
+{
+    size_t lines = 1;
+    char * p;
+    char * end = data + len;
+
+    memset(c, 0, sizeof(*c));
+    c->arena     = data;
+    c->arena_len = len;
+    if (len >= CREDENTIALS_NO_PASSWORD) {
+        return (NNG_EINVAL);
+    }
+    for (p = data; p < end; p++) {
+        lines += *p == '\n';
+    }
+    if ((c->offsets = nng_alloc(sizeof(uint32_t) * 2 * lines)) == NULL) {
+        return (NNG_ENOMEM);
+    }
+    c->slots = lines;
+
+    for (p = data; p < end;) {
+        char *nl  = memchr(p, '\n', end - p);
+        char *eol = nl != NULL ? nl : end;
+        char *colon;
+
+        *eol = '\0';
+        if (eol > p && eol[-1] == '\r') {
+            eol[-1] = '\0';
+        }
+        if (*p != '\0' && *p != '#') {
+            c->offsets[2 * c->count] = (uint32_t)(p - data);
+            if ((colon = strchr(p, ':')) != NULL) {
+                *colon                       = '\0';
+                c->offsets[2 * c->count + 1] = (uint32_t)(colon + 1 - data);
+            } else {
+                c->offsets[2 * c->count + 1] = CREDENTIALS_NO_PASSWORD;
+            }
+            c->count++;
+        }
+        p = eol + 1;
+    }
+    if (c->count == 0) {
+        credentials_fini(c);
+        return (NNG_EINVAL);
+    }
+    return (0);
+}
+
+void credentials_fini(struct credentials *c)
+{
+    if (c->offsets != NULL) {
+        nng_free(c->offsets, sizeof(uint32_t) * 2 * c->slots);
+    }
+    memset(c, 0, sizeof(*c));
+}
+
+const char *credentials_user(const struct credentials *c, size_t i)
+{
+    return c->arena + c->offsets[2 * (i % c->count)];
+}
+
+const char *credentials_password(const struct credentials *c, size_t i)
+{
+    uint32_t off = c->offsets[2 * (i % c->count) + 1];
+
+    return off == CREDENTIALS_NO_PASSWORD ? NULL : c->arena + off;
+}
+
+void credentials_expand(const char *tmpl, size_t index, char *buf, size_t len)
+{
+    size_t n = 0;
+
+    while (*tmpl != '\0' && n + 1 < len) {
+        if (tmpl[0] == '%' && tmpl[1] == 'i') {
+            int w = snprintf(buf + n, len - n, "%zu", index);
+            n     = w > 0 && (size_t) w < len - n ? n + w : len - 1;
+            tmpl += 2;
+        } else if (tmpl[0] == '%' && tmpl[1] == '%') {
+            buf[n++] = '%';
+            tmpl += 2;
+        } else {
+            buf[n++] = *tmpl++;
+        }
+    }
+    buf[n] = '\0';
+}
+
+void credentials_client_id(const char *tmpl, size_t conns, size_t index,
+                           char *buf, size_t len)
+{
+    if (strstr(tmpl, "%i") != NULL) {
+        credentials_expand(tmpl, index, buf, len);
+    } else if (conns > 1) {
+        // A broker drops the older of two sessions with the same id.
+        snprintf(buf, len, "%s-%zu", tmpl, index);
+    } else {
+        snprintf(buf, len, "%s", tmpl);
+    }
+}
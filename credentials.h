@@ -0,0 +1,38 @@
+#ifndef MQTT_BENCH_CREDENTIALS_H
+#define MQTT_BENCH_CREDENTIALS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Username/password pairs from a --credentials file, one "user:password"
+// per line. The file buffer itself is the arena: separators are
+// overwritten with NULs in place and only offsets are kept, so a million
+// identities cost their text plus eight bytes each.
+struct credentials {
+    char *    arena;
+    size_t    arena_len;
+    uint32_t *offsets; // user and password offset per pair
+    size_t    count;
+    size_t    slots; // pairs allocated, one per line
+};
+
+#define CREDENTIALS_NO_PASSWORD UINT32_MAX
+
+// Indexes data in place; it must be NUL terminated and outlive c, as a
+// buffer from loadfile() does.
+int         credentials_parse(struct credentials *c, char *data, size_t len);
+void        credentials_fini(struct credentials *c);
+const char *credentials_user(const struct credentials *c, size_t i);
+const char *credentials_password(const struct credentials *c, size_t i);
+
+// Copies tmpl to buf, replacing "%i" by index and "%%" by "%".
+void credentials_expand(const char *tmpl, size_t index, char *buf,
+                        size_t len);
+
+// The client id of connection index out of conns, from the --id
+// template: expanded when it has "%i", otherwise suffixed with
+// "-index" when there are several connections.
+void credentials_client_id(const char *tmpl, size_t conns, size_t index,
+                           char *buf, size_t len);
+
+#endif
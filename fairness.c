@@ -0,0 +1,113 @@
+#include "fairness.h"
+#include "bench.h"
+#include "credentials.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <nng/nng.h>
+
+struct conn_rank {
+    size_t index;
+    long   msgs;
+};
+
+static int rank_cmp(const void *a, const void *b)
+{
+    const struct conn_rank *x = a;
+    const struct conn_rank *y = b;
+
+    if (x->msgs != y->msgs) {
+        return x->msgs < y->msgs ? -1 : 1;
+    }
+    return x->index < y->index ? -1 : x->index > y->index;
+}
+
+// Connections ordered from the fewest messages to the most.
+static struct conn_rank *rank(const struct conn_stats *s, size_t n)
+{
+    struct conn_rank *r;
+
+    if ((r = nng_alloc(sizeof(*r) * n)) == NULL) {
+        fatal("Out of memory.");
+    }
+    for (size_t i = 0; i < n; i++) {
+        r[i].index = i;
+        r[i].msgs  = s[i].msgs;
+    }
+    qsort(r, n, sizeof(*r), rank_cmp);
+    return r;
+}
+
+void conn_stats_reset(struct conn_stats *s, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        s[i].msgs      = 0;
+        s[i].lat_count = 0;
+        s[i].lat_sum   = 0;
+        s[i].lat_max   = 0;
+    }
+}
+
+void fairness_compute(const struct conn_stats *s, size_t n, double elapsed,
+                      struct fairness *f)
+{
+    struct conn_rank *r;
+    double            sum = 0;
+    double            sq  = 0;
+    double            scale;
+
+    f->n = n;
+    if (n == 0) {
+        f->min = f->median = f->max = f->jain = 0;
+        return;
+    }
+    // Without a measured duration, compare raw counts.
+    scale = elapsed > 0 ? 1 / elapsed : 1;
+    r     = rank(s, n);
+    for (size_t i = 0; i < n; i++) {
+        sum += r[i].msgs;
+        sq += (double) r[i].msgs * r[i].msgs;
+    }
+    f->min    = r[0].msgs * scale;
+    f->max    = r[n - 1].msgs * scale;
+    f->median = (n % 2 ? r[n / 2].msgs
+                       : (r[n / 2 - 1].msgs + r[n / 2].msgs) / 2.0) *
+        scale;
+    f->jain = sq > 0 ? sum * sum / (n * sq) : 1;
+    nng_free(r, sizeof(*r) * n);
+}
+
+void fairness_print(const struct conn_stats *s, size_t n, double elapsed,
+                    const char *client_id, size_t worst)
+{
+    struct fairness   f;
+    struct conn_rank *r;
+    const char *      unit = elapsed > 0 ? "msg/sec" : "msgs";
+
+    fairness_compute(s, n, elapsed, &f);
+    printf("connections: %zu, rate min: %.1f, median: %.1f, max: %.1f(%s), "
+           "jain's fairness: %.4f\n",
+           n, f.min, f.median, f.max, unit, f.jain);
+
+    r     = rank(s, n);
+    worst = worst < n ? worst : n;
+    for (size_t i = 0; i < worst; i++) {
+        const struct conn_stats *c = &s[r[i].index];
+        char                     id[256];
+        printf("  worst #%zu: conn %zu", i + 1, r[i].index);
+        if (client_id != NULL) {
+            // The same id that connect_msg() gives the connection.
+            credentials_client_id(client_id, n, r[i].index, id, sizeof(id));
+            printf(" (%s)", id);
+        }
+        printf(", %.1f(%s)", elapsed > 0 ? r[i].msgs / elapsed : r[i].msgs,
+               unit);
+        if (c->lat_count > 0) {
+            printf(", latency mean: %.1fus, max: %lldus",
+                   (double) c->lat_sum / c->lat_count, (long long) c->lat_max);
+        }
+        printf("\n");
+    }
+    nng_free(r, sizeof(*r) * n);
+}
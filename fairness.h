@@ -0,0 +1,54 @@
+#ifndef MQTT_BENCH_FAIRNESS_H
+#define MQTT_BENCH_FAIRNESS_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+// Per-connection totals, so that a broker which starves a few clients
+// does not hide behind a healthy aggregate. One entry per connection,
+// updated from the callbacks of all its contexts, and one cache line each
+// so that neighbouring connections do not contend.
+struct conn_stats {
+    _Alignas(ARENA_CACHE_LINE) atomic_long msgs;
+    atomic_long  lat_count;
+    atomic_llong lat_sum; // us
+    atomic_llong lat_max; // us
+};
+
+// How evenly throughput was spread across connections. Jain's index is
+// (sum x)^2 / (n * sum x^2): 1 when all rates are equal, 1/n when one
+// connection got everything.
+struct fairness {
+    size_t n;
+    double min;
+    double median;
+    double max;
+    double jain;
+};
+
+static inline void conn_stats_record(struct conn_stats *s, int64_t lat)
+{
+    atomic_fetch_add_explicit(&s->msgs, 1, memory_order_relaxed);
+    if (lat < 0) {
+        return;
+    }
+    atomic_fetch_add_explicit(&s->lat_count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&s->lat_sum, lat, memory_order_relaxed);
+    long long max = atomic_load_explicit(&s->lat_max, memory_order_relaxed);
+    while (lat > max &&
+           !atomic_compare_exchange_weak_explicit(
+               &s->lat_max, &max, lat, memory_order_relaxed,
+               memory_order_relaxed)) {
+    }
+}
+
+void conn_stats_reset(struct conn_stats *s, size_t n);
+void fairness_compute(const struct conn_stats *s, size_t n, double elapsed,
+                      struct fairness *f);
+void fairness_print(const struct conn_stats *s, size_t n, double elapsed,
+                    const char *client_id, size_t worst);
+
+#endif
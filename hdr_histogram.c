@@ -0,0 +1,426 @@
+#include "hdr_histogram.h"
+#include "byteorder.h"
+
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+#include <nng/nng.h>
+#include <zlib.h>
+
+// The low nibble of the cookie base carries the word size (8 bytes).
+#define V2_ENCODING_COOKIE (0x1c849303 | 0x10)
+#define V2_COMPRESSION_COOKIE (0x1c849304 | 0x10)
+#define V2_HEADER_SIZE 40
+#define V2_MAX_WORD_SIZE 9
+
+// Values are recorded in microseconds, logs carry milliseconds.
+#define LOG_VALUE_UNIT_RATIO 1000.0
+
+static int32_t bucket_index(const struct hdr_histogram *h, int64_t value)
+{
+    int32_t pow2ceiling = 64 - __builtin_clzll(value | h->sub_bucket_mask);
+    return pow2ceiling - h->unit_magnitude -
+        (h->sub_bucket_half_count_magnitude + 1);
+}
+
+static int32_t sub_bucket_index(const struct hdr_histogram *h, int64_t value,
+                                int32_t bucket)
+{
+    return (int32_t)(value >> (bucket + h->unit_magnitude));
+}
+
+static int32_t counts_index(const struct hdr_histogram *h, int32_t bucket,
+                            int32_t sub_bucket)
+{
+    int32_t base = (bucket + 1) << h->sub_bucket_half_count_magnitude;
+    return base + (sub_bucket - h->sub_bucket_half_count);
+}
+
+static int32_t counts_index_for(const struct hdr_histogram *h, int64_t value)
+{
+    int32_t bucket = bucket_index(h, value);
+    return counts_index(h, bucket, sub_bucket_index(h, value, bucket));
+}
+
+static int64_t value_at_index(const struct hdr_histogram *h, int32_t index)
+{
+    int32_t bucket = (index >> h->sub_bucket_half_count_magnitude) - 1;
+    int32_t sub_bucket =
+        (index & (h->sub_bucket_half_count - 1)) + h->sub_bucket_half_count;
+
+    if (bucket < 0) {
+        sub_bucket -= h->sub_bucket_half_count;
+        bucket = 0;
+    }
+    return (int64_t) sub_bucket << (bucket + h->unit_magnitude);
+}
+
+static int64_t highest_equivalent_value(const struct hdr_histogram *h,
+                                        int64_t value)
+{
+    int32_t bucket     = bucket_index(h, value);
+    int32_t sub_bucket = sub_bucket_index(h, value, bucket);
+    int64_t lowest     = (int64_t) sub_bucket << (bucket + h->unit_magnitude);
+    int32_t adjusted =
+        sub_bucket >= h->sub_bucket_count ? bucket + 1 : bucket;
+
+    return lowest + ((int64_t) 1 << (h->unit_magnitude + adjusted)) - 1;
+}
+
+int hdr_init(int64_t lowest, int64_t highest, int sig_figs,
+             struct hdr_histogram **hp)
+{
+    struct hdr_histogram *h;
+    int64_t               largest_single_unit;
+    int64_t               smallest_untrackable;
+    int32_t               sub_bucket_count_magnitude;
+
+    if (lowest < 1 || sig_figs < 1 || sig_figs > 5 || highest < 2 * lowest) {
+        return (NNG_EINVAL);
+    }
+    if ((h = nng_alloc(sizeof(*h))) == NULL) {
+        return (NNG_ENOMEM);
+    }
+    memset(h, 0, sizeof(*h));
+
+    largest_single_unit = 2 * (int64_t) pow(10, sig_figs);
+    sub_bucket_count_magnitude =
+        (int32_t) ceil(log((double) largest_single_unit) / log(2));
+
+    h->lowest   = lowest;
+    h->highest  = highest;
+    h->sig_figs = sig_figs;
+    h->sub_bucket_half_count_magnitude =
+        (sub_bucket_count_magnitude > 1 ? sub_bucket_count_magnitude : 1) - 1;
+    h->unit_magnitude = (int32_t) floor(log((double) lowest) / log(2));
+    h->sub_bucket_count =
+        (int32_t) pow(2, h->sub_bucket_half_count_magnitude + 1);
+    h->sub_bucket_half_count = h->sub_bucket_count / 2;
+    h->sub_bucket_mask = ((int64_t) h->sub_bucket_count - 1)
+        << h->unit_magnitude;
+
+    smallest_untrackable = (int64_t) h->sub_bucket_count << h->unit_magnitude;
+    h->bucket_count      = 1;
+    while (smallest_untrackable <= highest) {
+        if (smallest_untrackable > INT64_MAX / 2) {
+            h->bucket_count++;
+            break;
+        }
+        smallest_untrackable <<= 1;
+        h->bucket_count++;
+    }
+    h->counts_len = (h->bucket_count + 1) * (h->sub_bucket_count / 2);
+
+    if ((h->counts = nng_alloc(sizeof(atomic_llong) * h->counts_len)) ==
+        NULL) {
+        nng_free(h, sizeof(*h));
+        return (NNG_ENOMEM);
+    }
+    hdr_reset(h);
+    *hp = h;
+    return (0);
+}
+
+void hdr_close(struct hdr_histogram *h)
+{
+    if (h != NULL) {
+        nng_free(h->counts, sizeof(atomic_llong) * h->counts_len);
+        nng_free(h, sizeof(*h));
+    }
+}
+
+void hdr_reset(struct hdr_histogram *h)
+{
+    for (int32_t i = 0; i < h->counts_len; i++) {
+        atomic_init(&h->counts[i], 0);
+    }
+    atomic_init(&h->total_count, 0);
+}
+
+// Values beyond the trackable range are clamped rather than dropped, so a
+// stalled broker still shows up at the top of the percentile spectrum.
+void hdr_record(struct hdr_histogram *h, int64_t value)
+{
+    if (value < 0) {
+        value = 0;
+    } else if (value > h->highest) {
+        value = h->highest;
+    }
+    atomic_fetch_add_explicit(&h->counts[counts_index_for(h, value)], 1,
+                              memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->total_count, 1, memory_order_relaxed);
+}
+
+// Both histograms must have been created with the same parameters.
+void hdr_add(struct hdr_histogram *dst, const struct hdr_histogram *src)
+{
+    int64_t total = 0;
+
+    for (int32_t i = 0; i < dst->counts_len; i++) {
+        int64_t c = atomic_load_explicit(&src->counts[i], memory_order_relaxed);
+        if (c != 0) {
+            atomic_fetch_add_explicit(&dst->counts[i], c,
+                                      memory_order_relaxed);
+            total += c;
+        }
+    }
+    atomic_fetch_add_explicit(&dst->total_count, total, memory_order_relaxed);
+}
+
+// Stores in out what h has recorded since the previous call, and moves
+// prev forward to the current state of h. The recording side never
+// blocks; a value racing with the snapshot lands in the next interval.
+void hdr_take_interval(struct hdr_histogram *h, struct hdr_histogram *prev,
+                       struct hdr_histogram *out)
+{
+    int64_t total = 0;
+
+    for (int32_t i = 0; i < h->counts_len; i++) {
+        int64_t cur = atomic_load_explicit(&h->counts[i], memory_order_relaxed);
+        int64_t old =
+            atomic_load_explicit(&prev->counts[i], memory_order_relaxed);
+        atomic_store_explicit(&out->counts[i], cur - old,
+                              memory_order_relaxed);
+        atomic_store_explicit(&prev->counts[i], cur, memory_order_relaxed);
+        total += cur - old;
+    }
+    atomic_store_explicit(&out->total_count, total, memory_order_relaxed);
+}
+
+int64_t hdr_count(const struct hdr_histogram *h)
+{
+    return atomic_load_explicit(&h->total_count, memory_order_relaxed);
+}
+
+int64_t hdr_min(const struct hdr_histogram *h)
+{
+    for (int32_t i = 0; i < h->counts_len; i++) {
+        if (atomic_load_explicit(&h->counts[i], memory_order_relaxed) > 0) {
+            return value_at_index(h, i);
+        }
+    }
+    return 0;
+}
+
+int64_t hdr_max(const struct hdr_histogram *h)
+{
+    for (int32_t i = h->counts_len - 1; i >= 0; i--) {
+        if (atomic_load_explicit(&h->counts[i], memory_order_relaxed) > 0) {
+            return highest_equivalent_value(h, value_at_index(h, i));
+        }
+    }
+    return 0;
+}
+
+double hdr_mean(const struct hdr_histogram *h)
+{
+    double  sum   = 0;
+    int64_t total = 0;
+
+    for (int32_t i = 0; i < h->counts_len; i++) {
+        int64_t c = atomic_load_explicit(&h->counts[i], memory_order_relaxed);
+        if (c > 0) {
+            int64_t v = value_at_index(h, i);
+            sum += c * (double) (v + highest_equivalent_value(h, v)) / 2;
+            total += c;
+        }
+    }
+    return total == 0 ? 0 : sum / total;
+}
+
+int64_t hdr_value_at_percentile(const struct hdr_histogram *h, double p)
+{
+    int64_t total = 0;
+    int64_t seen  = 0;
+    int64_t want;
+
+    for (int32_t i = 0; i < h->counts_len; i++) {
+        total += atomic_load_explicit(&h->counts[i], memory_order_relaxed);
+    }
+    if (total == 0) {
+        return 0;
+    }
+    p    = p > 100.0 ? 100.0 : p;
+    want = (int64_t)((p / 100.0) * total + 0.5);
+    want = want < 1 ? 1 : want;
+
+    for (int32_t i = 0; i < h->counts_len; i++) {
+        seen += atomic_load_explicit(&h->counts[i], memory_order_relaxed);
+        if (seen >= want) {
+            return highest_equivalent_value(h, value_at_index(h, i));
+        }
+    }
+    return 0;
+}
+
+// ZigZag LEB128 as used by the V2 encoding: at most nine bytes, and the
+// ninth byte carries a full eight bits.
+static size_t put_zigzag(uint8_t *p, int64_t value)
+{
+    uint64_t v = ((uint64_t) value << 1) ^ (uint64_t)(value >> 63);
+    size_t   n = 0;
+
+    while (n < V2_MAX_WORD_SIZE - 1) {
+        if ((v >> 7) == 0) {
+            p[n++] = (uint8_t) v;
+            return n;
+        }
+        p[n++] = (uint8_t)((v & 0x7f) | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (uint8_t) v;
+    return n;
+}
+
+static const char b64_table[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static char *base64_encode(const uint8_t *data, size_t len, size_t *lenp)
+{
+    size_t out_len = 4 * ((len + 2) / 3);
+    char * out;
+    size_t j = 0;
+
+    if ((out = nng_alloc(out_len + 1)) == NULL) {
+        return NULL;
+    }
+    for (size_t i = 0; i < len; i += 3) {
+        uint32_t n = (uint32_t) data[i] << 16;
+        if (i + 1 < len) {
+            n |= (uint32_t) data[i + 1] << 8;
+        }
+        if (i + 2 < len) {
+            n |= data[i + 2];
+        }
+        out[j++] = b64_table[(n >> 18) & 0x3f];
+        out[j++] = b64_table[(n >> 12) & 0x3f];
+        out[j++] = i + 1 < len ? b64_table[(n >> 6) & 0x3f] : '=';
+        out[j++] = i + 2 < len ? b64_table[n & 0x3f] : '=';
+    }
+    out[j] = '\0';
+    *lenp  = out_len;
+    return out;
+}
+
+// Encodes h in the V2 compressed format and returns it base64 encoded.
+// The returned string must be released with nng_free(*b64p, *lenp + 1).
+int hdr_encode_compressed(const struct hdr_histogram *h, char **b64p,
+                          size_t *lenp)
+{
+    int32_t  max_index = -1;
+    size_t   raw_size;
+    uint8_t *raw;
+    uint8_t *packed;
+    uLongf   packed_len;
+    size_t   pos;
+    int64_t  zeros = 0;
+    double   ratio = 1.0;
+    uint64_t ratio_bits;
+    int      rv = 0;
+
+    for (int32_t i = h->counts_len - 1; i >= 0; i--) {
+        if (atomic_load_explicit(&h->counts[i], memory_order_relaxed) > 0) {
+            max_index = i;
+            break;
+        }
+    }
+
+    raw_size = V2_HEADER_SIZE + (size_t)(max_index + 1) * V2_MAX_WORD_SIZE;
+    if ((raw = nng_alloc(raw_size)) == NULL) {
+        return (NNG_ENOMEM);
+    }
+
+    pos = V2_HEADER_SIZE;
+    for (int32_t i = 0; i <= max_index; i++) {
+        int64_t c = atomic_load_explicit(&h->counts[i], memory_order_relaxed);
+        if (c == 0) {
+            zeros++;
+            continue;
+        }
+        if (zeros > 0) {
+            pos += put_zigzag(raw + pos, -zeros);
+            zeros = 0;
+        }
+        pos += put_zigzag(raw + pos, c);
+    }
+
+    memcpy(&ratio_bits, &ratio, sizeof(ratio_bits));
+    put_be32(raw, V2_ENCODING_COOKIE);
+    put_be32(raw + 4, (uint32_t)(pos - V2_HEADER_SIZE));
+    put_be32(raw + 8, 0);
+    put_be32(raw + 12, (uint32_t) h->sig_figs);
+    put_be64(raw + 16, (uint64_t) h->lowest);
+    put_be64(raw + 24, (uint64_t) h->highest);
+    put_be64(raw + 32, ratio_bits);
+
+    packed_len = compressBound(pos);
+    if ((packed = nng_alloc(packed_len + 8)) == NULL) {
+        nng_free(raw, raw_size);
+        return (NNG_ENOMEM);
+    }
+    if (compress(packed + 8, &packed_len, raw, pos) != Z_OK) {
+        rv = NNG_EINVAL;
+        goto out;
+    }
+    put_be32(packed, V2_COMPRESSION_COOKIE);
+    put_be32(packed + 4, (uint32_t) packed_len);
+
+    if ((*b64p = base64_encode(packed, packed_len + 8, lenp)) == NULL) {
+        rv = NNG_ENOMEM;
+    }
+
+out:
+    nng_free(packed, compressBound(pos) + 8);
+    nng_free(raw, raw_size);
+    return (rv);
+}
+
+int hdr_log_open(struct hdr_log *log, const char *path, double base_time)
+{
+    time_t    secs = (time_t) base_time;
+    char      date[64];
+    struct tm tm;
+
+    if ((log->f = fopen(path, "w")) == NULL) {
+        return (errno);
+    }
+    log->base_time = base_time;
+
+    strftime(date, sizeof(date), "%a %b %d %H:%M:%S %Z %Y",
+             localtime_r(&secs, &tm));
+    fprintf(log->f, "#[Histogram log format version 1.3]\n");
+    fprintf(log->f, "#[StartTime: %.3f (seconds since epoch), %s]\n",
+            base_time, date);
+    fprintf(log->f, "#[BaseTime: %.3f (seconds since epoch)]\n", base_time);
+    fprintf(log->f, "\"StartTimestamp\",\"Interval_Length\","
+                    "\"Interval_Max\",\"Interval_Compressed_Histogram\"\n");
+    fflush(log->f);
+    return (0);
+}
+
+int hdr_log_write(struct hdr_log *log, double start, double end,
+                  const struct hdr_histogram *h)
+{
+    char * b64;
+    size_t len;
+    int    rv;
+
+    if ((rv = hdr_encode_compressed(h, &b64, &len)) != 0) {
+        return (rv);
+    }
+    fprintf(log->f, "%.3f,%.3f,%.3f,%s\n", start - log->base_time,
+            end - start, hdr_max(h) / LOG_VALUE_UNIT_RATIO, b64);
+    fflush(log->f);
+    nng_free(b64, len + 1);
+    return (0);
+}
+
+void hdr_log_close(struct hdr_log *log)
+{
+    if (log->f != NULL) {
+        fclose(log->f);
+        log->f = NULL;
+    }
+}
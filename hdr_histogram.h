@@ -0,0 +1,59 @@
+#ifndef MQTT_BENCH_HDR_HISTOGRAM_H
+#define MQTT_BENCH_HDR_HISTOGRAM_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// A compact HdrHistogram. The bucket layout and the V2 compressed
+// encoding match the reference implementation, so interval logs written
+// here can be merged and plotted with the stock HdrHistogram tools.
+// Recording is lock free and may happen from any nng callback thread.
+struct hdr_histogram {
+    int64_t         lowest;
+    int64_t         highest;
+    int32_t         sig_figs;
+    int32_t         unit_magnitude;
+    int32_t         sub_bucket_half_count_magnitude;
+    int32_t         sub_bucket_count;
+    int32_t         sub_bucket_half_count;
+    int64_t         sub_bucket_mask;
+    int32_t         bucket_count;
+    int32_t         counts_len;
+    atomic_llong    total_count;
+    atomic_llong *  counts;
+};
+
+int  hdr_init(int64_t lowest, int64_t highest, int sig_figs,
+              struct hdr_histogram **hp);
+void hdr_close(struct hdr_histogram *h);
+void hdr_reset(struct hdr_histogram *h);
+void hdr_record(struct hdr_histogram *h, int64_t value);
+void hdr_add(struct hdr_histogram *dst, const struct hdr_histogram *src);
+void hdr_take_interval(struct hdr_histogram *h, struct hdr_histogram *prev,
+                       struct hdr_histogram *out);
+
+int64_t hdr_count(const struct hdr_histogram *h);
+int64_t hdr_min(const struct hdr_histogram *h);
+int64_t hdr_max(const struct hdr_histogram *h);
+double  hdr_mean(const struct hdr_histogram *h);
+int64_t hdr_value_at_percentile(const struct hdr_histogram *h, double p);
+
+int hdr_encode_compressed(const struct hdr_histogram *h, char **b64p,
+                          size_t *lenp);
+
+// Writer for the HdrHistogram interval log format (version 1.3).
+// Timestamps are seconds relative to the base time in the header, and
+// values are recorded in microseconds and reported in milliseconds.
+struct hdr_log {
+    FILE * f;
+    double base_time;
+};
+
+int  hdr_log_open(struct hdr_log *log, const char *path, double base_time);
+int  hdr_log_write(struct hdr_log *log, double start, double end,
+                   const struct hdr_histogram *h);
+void hdr_log_close(struct hdr_log *log);
+
+#endif
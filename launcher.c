@@ -0,0 +1,212 @@
+#include "launcher.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct launch_slot {
+    uint64_t due;
+    size_t   index;
+};
+
+static const double milestones[LAUNCH_MILESTONES] = { 10, 25, 50, 75, 90, 99,
+                                                      100 };
+
+// Deterministic per-connection jitter, so that reruns dial alike.
+static uint64_t splitmix64(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// When connection index is due to dial, relative to the launch (us).
+static uint64_t due_us(const struct launcher *l, size_t index)
+{
+    uint64_t due = 0;
+
+    if (l->cfg.rate > 0) {
+        size_t batch = index / l->cfg.batch;
+        due = (uint64_t) batch * l->cfg.batch * 1000000 / l->cfg.rate;
+    }
+    if (l->cfg.jitter_ms > 0) {
+        due += splitmix64(index) % ((uint64_t) l->cfg.jitter_ms * 1000);
+    }
+    return due;
+}
+
+static int slot_cmp(const void *a, const void *b)
+{
+    const struct launch_slot *x = a;
+    const struct launch_slot *y = b;
+
+    if (x->due != y->due) {
+        return x->due < y->due ? -1 : 1;
+    }
+    return x->index < y->index ? -1 : x->index > y->index;
+}
+
+// Threads claim connections in order of due time, so dialing follows the
+// schedule even though setup times vary. Without jitter that is index
+// order; with it, a thread taking indices in order would block on the
+// largest jitter seen so far and dial everything after it late.
+static void launch_thread(void *arg)
+{
+    struct launcher *l = arg;
+    size_t           k;
+
+    while ((k = atomic_fetch_add(&l->next, 1)) < l->n) {
+        size_t   i   = l->order != NULL ? l->order[k].index : k;
+        uint64_t due = l->start_us +
+            (l->order != NULL ? l->order[k].due : due_us(l, i));
+        uint64_t now;
+
+        l->setup(l->arg, i);
+        // Sleeps under a millisecond are skipped; the next batch
+        // catches up, which keeps the average rate.
+        if ((now = bench_clock_us()) + 1000 <= due) {
+            nng_msleep((nng_duration)((due - now) / 1000));
+        }
+        l->dial(l->arg, i);
+        l->started++;
+    }
+}
+
+int launcher_init(struct launcher *l, const struct launch_cfg *cfg, size_t n,
+                  launch_fn setup, launch_fn dial, void *arg)
+{
+    memset(l, 0, sizeof(*l));
+    l->cfg   = *cfg;
+    l->n     = n;
+    l->setup = setup;
+    l->dial  = dial;
+    l->arg   = arg;
+    if (l->cfg.batch == 0) {
+        l->cfg.batch = 1;
+    }
+    if (l->cfg.threads == 0) {
+        l->cfg.threads = 1;
+    }
+    if (l->cfg.threads > n) {
+        l->cfg.threads = n > 0 ? n : 1;
+    }
+    if ((l->threads = nng_alloc(sizeof(nng_thread *) * l->cfg.threads)) ==
+        NULL) {
+        return (NNG_ENOMEM);
+    }
+    if (l->cfg.jitter_ms > 0 && n > 0) {
+        if ((l->order = nng_alloc(sizeof(*l->order) * n)) == NULL) {
+            nng_free(l->threads, sizeof(nng_thread *) * l->cfg.threads);
+            return (NNG_ENOMEM);
+        }
+        for (size_t i = 0; i < n; i++) {
+            l->order[i].due   = due_us(l, i);
+            l->order[i].index = i;
+        }
+        qsort(l->order, n, sizeof(*l->order), slot_cmp);
+    }
+    return (0);
+}
+
+// Returns once every dialer has been started, printing the ramp every
+// second in the meantime. Connections keep coming up afterwards.
+void launcher_run(struct launcher *l)
+{
+    int rv;
+
+    l->start_us = bench_clock_us();
+    for (uint32_t i = 0; i < l->cfg.threads; i++) {
+        if ((rv = nng_thread_create(&l->threads[i], launch_thread, l)) != 0) {
+            fatal("nng_thread_create: %s", nng_strerror(rv));
+        }
+    }
+    for (;;) {
+        for (int i = 0; i < 10 && l->started < (long) l->n; i++) {
+            nng_msleep(100);
+        }
+        if (l->started >= (long) l->n) {
+            break;
+        }
+        launcher_print_ramp(l);
+    }
+    for (uint32_t i = 0; i < l->cfg.threads; i++) {
+        nng_thread_destroy(l->threads[i]);
+    }
+    nng_free(l->threads, sizeof(nng_thread *) * l->cfg.threads);
+    l->threads = NULL;
+    if (l->order != NULL) {
+        nng_free(l->order, sizeof(*l->order) * l->n);
+        l->order = NULL;
+    }
+}
+
+void launcher_up(struct launcher *l, bool first)
+{
+    long n;
+
+    l->up++;
+    l->connects++;
+    if (!first) {
+        return;
+    }
+    n = ++l->ever_up;
+    for (int i = 0; i < LAUNCH_MILESTONES; i++) {
+        long target = (long) ((l->n * milestones[i] + 99) / 100);
+        if (n == (target > 0 ? target : 1)) {
+            l->milestone_us[i] = bench_clock_us() - l->start_us;
+        }
+    }
+}
+
+void launcher_down(struct launcher *l)
+{
+    l->up--;
+}
+
+bool launcher_ramping(const struct launcher *l)
+{
+    return l->ever_up < (long) l->n || !l->all_up_reported;
+}
+
+void launcher_print_ramp(struct launcher *l)
+{
+    long     up       = l->up;
+    long     ever     = l->ever_up;
+    long     connects = l->connects;
+    uint64_t now      = bench_clock_us();
+    uint64_t since    = l->last_us > 0 ? l->last_us : l->start_us;
+
+    if (ever >= (long) l->n) {
+        if (!l->all_up_reported) {
+            l->all_up_reported = true;
+            printf("all %zu connections up after %.3fs\n", l->n,
+                   l->milestone_us[LAUNCH_MILESTONES - 1] / 1e6);
+        }
+        return;
+    }
+    // Connects, not the change in live connections, which disconnects
+    // would eat into.
+    printf("connections: started: %ld/%zu, up: %ld, connects: "
+           "%.1f(conn/sec), time: %.1fs\n",
+           (long) l->started, l->n, up,
+           now > since ? (connects - l->last_connects) * 1e6 / (now - since)
+                       : 0.0,
+           (now - l->start_us) / 1e6);
+    l->last_connects = connects;
+    l->last_us       = now;
+}
+
+void launcher_print_milestones(const struct launcher *l)
+{
+    printf("connection ramp:");
+    for (int i = 0; i < LAUNCH_MILESTONES; i++) {
+        if (l->milestone_us[i] == 0) {
+            printf(" %g%%: -", milestones[i]);
+        } else {
+            printf(" %g%%: %.3fs", milestones[i], l->milestone_us[i] / 1e6);
+        }
+    }
+    printf("\n");
+}
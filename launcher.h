@@ -0,0 +1,56 @@
+#ifndef MQTT_BENCH_LAUNCHER_H
+#define MQTT_BENCH_LAUNCHER_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <nng/nng.h>
+#include <nng/supplemental/util/platform.h>
+
+// Brings up many connections without a thundering herd: setup (socket,
+// contexts, dialer) runs on several threads, and dialing is paced to a
+// connection rate in batches, with a per-connection jitter.
+struct launch_cfg {
+    uint32_t rate;      // connections/sec, 0 dials as soon as set up
+    uint32_t batch;     // connections dialed together
+    uint32_t jitter_ms; // random extra delay per connection
+    uint32_t threads;
+};
+
+typedef void (*launch_fn)(void *arg, size_t index);
+
+// Share of the connections up, in percent, at which the ramp is timed.
+#define LAUNCH_MILESTONES 7
+
+struct launcher {
+    struct launch_cfg cfg;
+    size_t            n;
+    launch_fn         setup;
+    launch_fn         dial;
+    void *            arg;
+    nng_thread **     threads;
+    struct launch_slot *order; // by due time, only with jitter
+    atomic_size_t     next;
+    uint64_t          start_us;
+    atomic_long       started;   // dialers started
+    atomic_long       up;        // connections up right now
+    atomic_long       ever_up;   // connections that came up at least once
+    atomic_long       connects;  // accepted CONNACKs, reconnects included
+    atomic_ullong     milestone_us[LAUNCH_MILESTONES];
+    long              last_connects; // for the ramp rate
+    uint64_t          last_us;
+    bool              all_up_reported;
+};
+
+int  launcher_init(struct launcher *l, const struct launch_cfg *cfg, size_t n,
+                   launch_fn setup, launch_fn dial, void *arg);
+void launcher_run(struct launcher *l);
+void launcher_up(struct launcher *l, bool first);
+void launcher_down(struct launcher *l);
+bool launcher_ramping(const struct launcher *l);
+void launcher_print_ramp(struct launcher *l);
+void launcher_print_milestones(const struct launcher *l);
+
+#endif
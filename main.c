@@ -13,6 +13,8 @@ int main(int argc, char **argv)
         client(argc - 2, argv + 2, SUB);
     } else if (strcmp(argv[1], "conn") == 0) {
         client(argc - 2, argv + 2, CONN);
+    } else if (strcmp(argv[1], "compare") == 0) {
+        compare(argc - 2, argv + 2);
     } else {
         goto out;
     }
@@ -20,5 +22,5 @@ int main(int argc, char **argv)
     return 0;
 
 out:
-    fatal("\nUsage: %s { pub | sub | conn } [--help]\n", argv[0]);
+    fatal("\nUsage: %s { pub | sub | conn | compare } [--help]\n", argv[0]);
 }
\ No newline at end of file
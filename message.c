@@ -0,0 +1,73 @@
+#include "message.h"
+#include "pub_template.h"
+
+#include <nng/mqtt/mqtt_client.h>
+
+// Each connection gets its own identity, so that the broker cannot serve
+// repeated logins from a cache: credentials come from --credentials, or
+// from --user/--password templates with %i for the connection index.
+nng_msg *connect_msg(const struct connect_cfg *cfg, size_t index)
+{
+    nng_msg *msg;
+    char     buf[256];
+
+    if (nng_mqtt_msg_alloc(&msg, 0) != 0) {
+        return NULL;
+    }
+    nng_mqtt_msg_set_packet_type(msg, NNG_MQTT_CONNECT);
+    nng_mqtt_msg_set_connect_proto_version(msg, cfg->version);
+    nng_mqtt_msg_set_connect_keep_alive(msg, cfg->keepalive);
+    nng_mqtt_msg_set_connect_clean_session(msg, cfg->clean_session);
+
+    if (cfg->client_id) {
+        credentials_client_id(cfg->client_id, cfg->conns, index, buf,
+                              sizeof(buf));
+        nng_mqtt_msg_set_connect_client_id(msg, buf);
+    }
+    if (cfg->creds != NULL && cfg->creds->count > 0) {
+        const char *pass = credentials_password(cfg->creds, index);
+        nng_mqtt_msg_set_connect_user_name(
+            msg, credentials_user(cfg->creds, index));
+        if (pass != NULL) {
+            nng_mqtt_msg_set_connect_password(msg, pass);
+        }
+    } else {
+        if (cfg->user) {
+            credentials_expand(cfg->user, index, buf, sizeof(buf));
+            nng_mqtt_msg_set_connect_user_name(msg, buf);
+        }
+        if (cfg->passwd) {
+            credentials_expand(cfg->passwd, index, buf, sizeof(buf));
+            nng_mqtt_msg_set_connect_password(msg, buf);
+        }
+    }
+    if (cfg->will_topic) {
+        nng_mqtt_msg_set_connect_will_topic(msg, cfg->will_topic);
+    }
+    if (cfg->will_qos) {
+        nng_mqtt_msg_set_connect_will_qos(msg, cfg->will_qos);
+    }
+    if (cfg->will_msg) {
+        nng_mqtt_msg_set_connect_will_msg(msg, cfg->will_msg,
+                                          cfg->will_msg_len);
+    }
+    if (cfg->will_retain) {
+        nng_mqtt_msg_set_connect_will_retain(msg, cfg->will_retain);
+    }
+
+    return msg;
+}
+
+int64_t stats_received(struct hdr_histogram *h, struct conn_stats *cs,
+                       const uint8_t *payload, size_t len, uint64_t now)
+{
+    struct stamp stamp;
+    int64_t      lat = -1;
+
+    if (stamp_parse(payload, len, &stamp)) {
+        lat = (int64_t)(now - stamp.due);
+        hdr_record(h, lat);
+    }
+    conn_stats_record(cs, lat);
+    return lat;
+}
@@ -0,0 +1,50 @@
+#ifndef MQTT_BENCH_MESSAGE_H
+#define MQTT_BENCH_MESSAGE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <nng/nng.h>
+
+#include "credentials.h"
+#include "fairness.h"
+#include "hdr_histogram.h"
+
+// Per-connection and per-message building blocks of the client, kept
+// apart from bench.c so that nng-mqtt-bench-micro times the very code
+// the client runs.
+
+// What a CONNECT is made of, from the client options.
+struct connect_cfg {
+    uint8_t                   version;
+    uint16_t                  keepalive;
+    bool                      clean_session;
+    const char *              client_id; // see credentials_client_id()
+    size_t                    conns;
+    const char *              user;   // may contain %i
+    const char *              passwd; // may contain %i
+    const struct credentials *creds;  // takes precedence when not empty
+    const char *              will_topic;
+    uint8_t                   will_qos;
+    uint8_t *                 will_msg;
+    size_t                    will_msg_len;
+    bool                      will_retain;
+};
+
+nng_msg *connect_msg(const struct connect_cfg *cfg, size_t index);
+
+// A send completed lat us after it was due.
+static inline void stats_sent(struct hdr_histogram *h, struct conn_stats *cs,
+                              int64_t lat)
+{
+    hdr_record(h, lat);
+    conn_stats_record(cs, lat);
+}
+
+// Records a received payload and returns its latency from the stamp, or
+// -1 when it carries none. now is wall-clock time in us.
+int64_t stats_received(struct hdr_histogram *h, struct conn_stats *cs,
+                       const uint8_t *payload, size_t len, uint64_t now);
+
+#endif
@@ -0,0 +1,451 @@
+// Microbenchmarks of the client's own hot paths: building, duplicating
+// and encoding PUBLISH messages, CONNECT encoding, decoding a received
+// PUBLISH and the statistics update done per message. A regression here lowers the rate the client
+// can drive, and would otherwise show up as a slower broker.
+
+#include "bench.h"
+#include "checksum.h"
+#include "credentials.h"
+#include "fairness.h"
+#include "hdr_histogram.h"
+#include "message.h"
+#include "pub_template.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <nng/mqtt/mqtt_client.h>
+#include <nng/nng.h>
+
+static const size_t payload_sizes[] = { 16, 256, 4096, 65536, 1048576 };
+static const size_t topic_lens[]    = { 8, 64, 512 };
+
+static uint64_t clock_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+// Allocations are counted by interposing malloc(3), which catches nng's
+// own allocations as well as ours. Only the measuring thread counts, so
+// that nng's background threads do not add to the figures.
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static _Thread_local bool     counting;
+static _Thread_local uint64_t alloc_count;
+static _Thread_local uint64_t alloc_bytes;
+
+void *malloc(size_t size)
+{
+    if (counting) {
+        alloc_count++;
+        alloc_bytes += size;
+    }
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+    if (counting) {
+        alloc_count++;
+        alloc_bytes += n * size;
+    }
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    if (counting) {
+        alloc_count++;
+        alloc_bytes += size;
+    }
+    return __libc_realloc(ptr, size);
+}
+
+#define ALLOC_COUNTING true
+#else
+static bool     counting;
+static uint64_t alloc_count;
+static uint64_t alloc_bytes;
+
+#define ALLOC_COUNTING false
+#endif
+
+struct micro {
+    const char *filter;
+    uint64_t    min_ns; // per case
+};
+
+struct micro_case {
+    const char *name;
+    size_t      size;      // payload bytes, 0 when not applicable
+    size_t      topic_len; // 0 when not applicable
+    void (*fn)(void *arg, uint64_t iters);
+    void *arg;
+};
+
+static uint64_t time_iters(const struct micro_case *c, uint64_t iters)
+{
+    uint64_t start = clock_ns();
+    c->fn(c->arg, iters);
+    return clock_ns() - start;
+}
+
+static void print_dim(size_t v, int width)
+{
+    if (v > 0) {
+        printf(" %*zu", width, v);
+    } else {
+        printf(" %*s", width, "-");
+    }
+}
+
+// Doubles the iteration count until a batch takes a tenth of the time
+// budget, then runs one batch sized to fill the budget, with allocations
+// counted.
+static void measure(const struct micro *m, const struct micro_case *c)
+{
+    uint64_t iters = 1;
+    uint64_t ns;
+
+    if (m->filter != NULL && strstr(c->name, m->filter) == NULL) {
+        return;
+    }
+    c->fn(c->arg, 1); // warm up
+    while ((ns = time_iters(c, iters)) < m->min_ns / 10 &&
+           iters < (1ULL << 40)) {
+        iters *= 2;
+    }
+    if (ns > 0 && ns < m->min_ns) {
+        iters = iters * m->min_ns / ns;
+    }
+
+    alloc_count = 0;
+    alloc_bytes = 0;
+    counting    = true;
+    ns          = time_iters(c, iters);
+    counting    = false;
+
+    printf("%-16s", c->name);
+    print_dim(c->size, 8);
+    print_dim(c->topic_len, 6);
+    printf(" %12.1f", (double) ns / iters);
+    if (ALLOC_COUNTING) {
+        printf(" %10.2f %12.1f\n", (double) alloc_count / iters,
+               (double) alloc_bytes / iters);
+    } else {
+        printf(" %10s %12s\n", "-", "-");
+    }
+    fflush(stdout);
+}
+
+static char *make_topic(size_t len)
+{
+    char *topic;
+
+    if ((topic = malloc(len + 1)) == NULL) {
+        fatal("Out of memory.");
+    }
+    for (size_t i = 0; i < len; i++) {
+        topic[i] = (i % 8 == 7) ? '/' : (char) ('a' + i % 26);
+    }
+    topic[len] = '\0';
+    return topic;
+}
+
+static void run_publish(void *arg, uint64_t iters)
+{
+    struct pub_template *t = arg;
+
+    for (uint64_t i = 0; i < iters; i++) {
+        nng_msg *msg;
+        if ((msg = pub_template_next(t, i, i)) == NULL) {
+            fatal("nng_msg_dup: out of memory");
+        }
+        // Encoding happens when the message is first sent; force it here.
+        nng_mqtt_msg_encode(msg);
+        nng_msg_free(msg);
+    }
+}
+
+static void run_msg_dup(void *arg, uint64_t iters)
+{
+    struct pub_template *t = arg;
+
+    for (uint64_t i = 0; i < iters; i++) {
+        nng_msg *msg;
+        if (nng_msg_dup(&msg, t->msg) != 0) {
+            fatal("nng_msg_dup: out of memory");
+        }
+        nng_mqtt_msg_encode(msg);
+        nng_msg_free(msg);
+    }
+}
+
+// A PUBLISH as it comes off the wire.
+struct wire_msg {
+    uint8_t *header;
+    size_t   header_len;
+    uint8_t *body;
+    size_t   body_len;
+};
+
+static void wire_init(struct wire_msg *w, const struct pub_template *t)
+{
+    nng_msg *msg;
+
+    if (nng_msg_dup(&msg, t->msg) != 0 || nng_mqtt_msg_encode(msg) != 0) {
+        fatal("wire_init: cannot encode PUBLISH");
+    }
+    w->header_len = nng_msg_header_len(msg);
+    w->body_len   = nng_msg_len(msg);
+    if ((w->header = malloc(w->header_len)) == NULL ||
+        (w->body = malloc(w->body_len)) == NULL) {
+        fatal("Out of memory.");
+    }
+    memcpy(w->header, nng_msg_header(msg), w->header_len);
+    memcpy(w->body, nng_msg_body(msg), w->body_len);
+    nng_msg_free(msg);
+}
+
+static void wire_fini(struct wire_msg *w)
+{
+    free(w->header);
+    free(w->body);
+}
+
+// What a subscriber does with each PUBLISH before the statistics: the
+// transport reads it into a fresh message, which is decoded and its
+// payload checked.
+static void run_decode(void *arg, uint64_t iters)
+{
+    struct wire_msg *w = arg;
+
+    for (uint64_t i = 0; i < iters; i++) {
+        nng_msg *    msg;
+        uint32_t     len;
+        uint8_t *    payload;
+        struct stamp stamp;
+        if (nng_mqtt_msg_alloc(&msg, 0) != 0 ||
+            nng_msg_header_append(msg, w->header, w->header_len) != 0 ||
+            nng_msg_append(msg, w->body, w->body_len) != 0) {
+            fatal("nng_mqtt_msg_alloc: out of memory");
+        }
+        if (nng_mqtt_msg_decode(msg) != 0) {
+            fatal("decode: bad PUBLISH");
+        }
+        payload = nng_mqtt_msg_get_publish_payload(msg, &len);
+        if (!stamp_parse(payload, len, &stamp) ||
+            checksum_verify(payload, len) != CHECKSUM_OK) {
+            fatal("decode: bad payload");
+        }
+        nng_msg_free(msg);
+    }
+}
+
+struct stats_arg {
+    struct hdr_histogram *h;
+    struct conn_stats     cs;
+    const uint8_t *       payload; // stamped, for stats_recv
+    uint32_t              len;
+    uint64_t              due;
+};
+
+static void run_stats_sent(void *arg, uint64_t iters)
+{
+    struct stats_arg *s = arg;
+
+    for (uint64_t i = 0; i < iters; i++) {
+        stats_sent(s->h, &s->cs, (int64_t)(i & 0xffff) + 1);
+    }
+}
+
+static void run_stats_received(void *arg, uint64_t iters)
+{
+    struct stats_arg *s = arg;
+
+    for (uint64_t i = 0; i < iters; i++) {
+        if (stats_received(s->h, &s->cs, s->payload, s->len,
+                           s->due + (i & 0xffff) + 1) < 0) {
+            fatal("stats_received: bad payload");
+        }
+    }
+}
+
+// A templated identity, the most expensive variant.
+static void run_connect(void *arg, uint64_t iters)
+{
+    const char *       topic = arg;
+    struct credentials creds = { 0 };
+    struct connect_cfg cfg   = {
+        .version       = 4,
+        .keepalive     = 60,
+        .clean_session = true,
+        .client_id     = "bench-%i",
+        .conns         = 2,
+        .user          = "user-%i",
+        .passwd        = "secret-%i",
+        .creds         = &creds,
+        .will_topic    = topic,
+    };
+
+    for (uint64_t i = 0; i < iters; i++) {
+        nng_msg *msg;
+        if ((msg = connect_msg(&cfg, i)) == NULL) {
+            fatal("connect_msg: out of memory");
+        }
+        // Encoding happens when the message is first sent; force it here.
+        nng_mqtt_msg_encode(msg);
+        nng_msg_free(msg);
+    }
+}
+
+static void template_init(struct pub_template *t, const char *topic,
+                          const uint8_t *payload, size_t len, int flags,
+                          uint32_t vary)
+{
+    int rv;
+
+    if ((rv = pub_template_init(t, topic, 1, false, payload, len, flags, vary,
+                                0)) != 0) {
+        fatal("pub_template_init: %s", nng_strerror(rv));
+    }
+}
+
+static void usage(void)
+{
+    fatal("Usage: " APP_NAME "-micro [--filter <name>] [--time <ms>]\n\n"
+          "Times the client's per-message code paths in tight loops and\n"
+          "reports ns/op, and allocations and allocated bytes per op.\n"
+          "  --filter <name>  only run cases whose name contains <name>\n"
+          "  --time <ms>      time budget per case [default: 200]");
+}
+
+int main(int argc, char **argv)
+{
+    static const struct {
+        const char *name;
+        int         flags;
+        uint32_t    vary;
+    } publishes[] = {
+        { "publish", 0, 1 },
+        { "publish_stamp", PUB_TEMPLATE_STAMP, 1 },
+        { "publish_crc", PUB_TEMPLATE_STAMP | PUB_TEMPLATE_CHECKSUM, 1 },
+        { "publish_vary", 0, 1000 },
+    };
+    struct micro     m = { .min_ns = 200 * 1000000ULL };
+    struct stats_arg st;
+    uint8_t *        payload;
+    size_t           max_size = payload_sizes[sizeof(payload_sizes) /
+                                        sizeof(payload_sizes[0]) - 1];
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            m.filter = argv[++i];
+        } else if (strcmp(argv[i], "--time") == 0 && i + 1 < argc) {
+            char *end;
+            long  ms = strtol(argv[++i], &end, 10);
+            if (*end != '\0' || ms <= 0) {
+                fatal("Invalid time %s", argv[i]);
+            }
+            m.min_ns = (uint64_t) ms * 1000000;
+        } else {
+            usage();
+        }
+    }
+
+    crc32c_init();
+    if ((payload = malloc(max_size)) == NULL) {
+        fatal("Out of memory.");
+    }
+    for (size_t i = 0; i < max_size; i++) {
+        payload[i] = (uint8_t) i;
+    }
+
+    printf("crc32c: %s, allocation counting: %s\n\n", crc32c_impl(),
+           ALLOC_COUNTING ? "on" : "unavailable");
+    printf("%-16s %8s %6s %12s %10s %12s\n", "case", "payload", "topic",
+           "ns/op", "allocs/op", "bytes/op");
+
+    for (size_t p = 0; p < sizeof(publishes) / sizeof(publishes[0]); p++) {
+        for (size_t t = 0; t < sizeof(topic_lens) / sizeof(topic_lens[0]);
+             t++) {
+            char *topic = make_topic(topic_lens[t]);
+            for (size_t s = 0;
+                 s < sizeof(payload_sizes) / sizeof(payload_sizes[0]); s++) {
+                struct pub_template tmpl;
+                template_init(&tmpl, topic, payload, payload_sizes[s],
+                              publishes[p].flags, publishes[p].vary);
+                measure(&m,
+                        &(struct micro_case){ publishes[p].name,
+                                              payload_sizes[s], topic_lens[t],
+                                              run_publish, &tmpl });
+                pub_template_fini(&tmpl);
+            }
+            free(topic);
+        }
+    }
+
+    for (size_t s = 0; s < sizeof(payload_sizes) / sizeof(payload_sizes[0]);
+         s++) {
+        struct pub_template tmpl;
+        struct wire_msg     wire;
+        char *              topic = make_topic(topic_lens[0]);
+
+        template_init(&tmpl, topic, payload, payload_sizes[s], 0, 1);
+        measure(&m, &(struct micro_case){ "msg_dup", payload_sizes[s],
+                                          topic_lens[0], run_msg_dup, &tmpl });
+        pub_template_fini(&tmpl);
+
+        template_init(&tmpl, topic, payload, payload_sizes[s],
+                      PUB_TEMPLATE_STAMP | PUB_TEMPLATE_CHECKSUM, 1);
+        wire_init(&wire, &tmpl);
+        measure(&m, &(struct micro_case){ "decode", payload_sizes[s],
+                                          topic_lens[0], run_decode, &wire });
+        wire_fini(&wire);
+        pub_template_fini(&tmpl);
+        free(topic);
+    }
+
+    for (size_t t = 0; t < sizeof(topic_lens) / sizeof(topic_lens[0]); t++) {
+        char *topic = make_topic(topic_lens[t]);
+        measure(&m, &(struct micro_case){ "connect_msg", 0, topic_lens[t],
+                                          run_connect, topic });
+        free(topic);
+    }
+
+    memset(&st, 0, sizeof(st));
+    if (hdr_init(1, LATENCY_MAX_US, 3, &st.h) != 0) {
+        fatal("Out of memory.");
+    }
+    measure(&m, &(struct micro_case){ "stats_sent", 0, 0, run_stats_sent,
+                                      &st });
+    {
+        struct pub_template tmpl;
+        struct stamp        stamp;
+        char *              topic = make_topic(topic_lens[0]);
+
+        template_init(&tmpl, topic, payload, payload_sizes[0],
+                      PUB_TEMPLATE_STAMP, 1);
+        st.payload = nng_mqtt_msg_get_publish_payload(tmpl.msg, &st.len);
+        if (!stamp_parse(st.payload, st.len, &stamp)) {
+            fatal("stats_received: bad payload");
+        }
+        st.due = stamp.due;
+        measure(&m, &(struct micro_case){ "stats_received", 0, 0,
+                                          run_stats_received, &st });
+        pub_template_fini(&tmpl);
+        free(topic);
+    }
+    hdr_close(st.h);
+
+    free(payload);
+    return 0;
+}
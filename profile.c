@@ -0,0 +1,342 @@
+#ifdef __linux__
+#define _GNU_SOURCE // sched_getaffinity
+#endif
+
+#include "profile.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <linux/perf_event.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#endif
+
+#include <nng/nng.h>
+
+static uint64_t clock_ns(clockid_t id)
+{
+    struct timespec ts;
+    clock_gettime(id, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+uint64_t profile_thread_ns(void)
+{
+    return clock_ns(CLOCK_THREAD_CPUTIME_ID);
+}
+
+static size_t usable_cpus(void)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) > 0) {
+        return CPU_COUNT(&set);
+    }
+#endif
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (size_t) n : 1;
+}
+
+#ifdef __linux__
+static int perf_open(uint64_t config, bool kernel)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size           = sizeof(attr);
+    attr.type           = PERF_TYPE_HARDWARE;
+    attr.config         = config;
+    attr.inherit        = 1;
+    attr.exclude_kernel = !kernel;
+    attr.exclude_hv     = 1;
+    return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1,
+                         PERF_FLAG_FD_CLOEXEC);
+}
+
+// Kernel time is where the socket syscalls go, so it is counted when the
+// perf_event_paranoid setting allows; otherwise user space only.
+static void perf_init(struct profile *p)
+{
+    static const uint64_t configs[COUNTER_COUNT] = {
+        [COUNTER_CYCLES]       = PERF_COUNT_HW_CPU_CYCLES,
+        [COUNTER_INSTRUCTIONS] = PERF_COUNT_HW_INSTRUCTIONS,
+    };
+
+    for (int kernel = 1; kernel >= 0; kernel--) {
+        int i;
+        for (i = 0; i < COUNTER_COUNT; i++) {
+            if ((p->perf_fd[i] = perf_open(configs[i], kernel)) < 0) {
+                break;
+            }
+        }
+        if (i == COUNTER_COUNT) {
+            p->perf_kernel = kernel;
+            return;
+        }
+        while (i-- > 0) {
+            close(p->perf_fd[i]);
+            p->perf_fd[i] = -1;
+        }
+    }
+}
+
+static uint64_t perf_read(int fd)
+{
+    uint64_t v = 0;
+
+    if (fd < 0 || read(fd, &v, sizeof(v)) != sizeof(v)) {
+        return 0;
+    }
+    return v;
+}
+
+// Reads utime + stime of one thread from /proc/self/task/<tid>/stat.
+// The name is in parentheses and may itself contain spaces and
+// parentheses, so fields are counted from the last ')'.
+static bool thread_read(int tid, struct profile_thread *t)
+{
+    char          path[64];
+    char          buf[512];
+    FILE *        f;
+    size_t        n;
+    char *        name;
+    char *        end;
+    unsigned long utime;
+    unsigned long stime;
+
+    snprintf(path, sizeof(path), "/proc/self/task/%d/stat", tid);
+    if ((f = fopen(path, "r")) == NULL) {
+        return false;
+    }
+    n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+    if ((name = strchr(buf, '(')) == NULL ||
+        (end = strrchr(buf, ')')) == NULL || end < name) {
+        return false;
+    }
+    if (sscanf(end + 1,
+               " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+               &utime, &stime) != 2) {
+        return false;
+    }
+    n = end - name - 1;
+    n = n < sizeof(t->name) - 1 ? n : sizeof(t->name) - 1;
+    memcpy(t->name, name + 1, n);
+    t->name[n] = '\0';
+    t->tid     = tid;
+    t->ticks   = utime + stime;
+    return true;
+}
+
+// Calls fn for every live thread of the process.
+static void threads_each(void (*fn)(void *, const struct profile_thread *),
+                         void *arg)
+{
+    DIR *                 d;
+    struct dirent *       e;
+    struct profile_thread t;
+
+    if ((d = opendir("/proc/self/task")) == NULL) {
+        return;
+    }
+    while ((e = readdir(d)) != NULL) {
+        if (isdigit((unsigned char) e->d_name[0]) &&
+            thread_read(atoi(e->d_name), &t)) {
+            fn(arg, &t);
+        }
+    }
+    closedir(d);
+}
+
+static void thread_save(void *arg, const struct profile_thread *t)
+{
+    struct profile *p = arg;
+
+    if (p->nthreads == p->cap) {
+        size_t                 cap = p->cap == 0 ? 16 : p->cap * 2;
+        struct profile_thread *threads;
+        if ((threads = nng_alloc(sizeof(*threads) * cap)) == NULL) {
+            return;
+        }
+        if (p->threads != NULL) {
+            memcpy(threads, p->threads, sizeof(*threads) * p->nthreads);
+            nng_free(p->threads, sizeof(*threads) * p->cap);
+        }
+        p->threads = threads;
+        p->cap     = cap;
+    }
+    p->threads[p->nthreads++] = *t;
+}
+
+struct busiest {
+    const struct profile *p;
+    uint64_t              ticks;
+    char                  name[16];
+};
+
+static void thread_busiest(void *arg, const struct profile_thread *t)
+{
+    struct busiest *b     = arg;
+    uint64_t        ticks = t->ticks;
+
+    // Threads that started after profile_begin() count from zero.
+    for (size_t i = 0; i < b->p->nthreads; i++) {
+        if (b->p->threads[i].tid == t->tid) {
+            ticks -= b->p->threads[i].ticks;
+            break;
+        }
+    }
+    if (ticks > b->ticks) {
+        b->ticks = ticks;
+        memcpy(b->name, t->name, sizeof(b->name));
+    }
+}
+#endif
+
+int profile_init(struct profile **pp)
+{
+    struct profile *p;
+
+    if ((p = nng_alloc(sizeof(*p))) == NULL) {
+        return (NNG_ENOMEM);
+    }
+    memset(p, 0, sizeof(*p));
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        p->perf_fd[i] = -1;
+    }
+    p->ncpus = usable_cpus();
+#ifdef __linux__
+    perf_init(p);
+#endif
+    *pp = p;
+    return (0);
+}
+
+void profile_fini(struct profile *p)
+{
+    if (p == NULL) {
+        return;
+    }
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        if (p->perf_fd[i] >= 0) {
+            close(p->perf_fd[i]);
+        }
+    }
+    if (p->threads != NULL) {
+        nng_free(p->threads, sizeof(*p->threads) * p->cap);
+    }
+    nng_free(p, sizeof(*p));
+}
+
+static uint64_t tv_us(struct timeval tv)
+{
+    return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+void profile_begin(struct profile *p)
+{
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    p->user_us = tv_us(ru.ru_utime);
+    p->sys_us  = tv_us(ru.ru_stime);
+    p->vcsw    = ru.ru_nvcsw;
+    p->ivcsw   = ru.ru_nivcsw;
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        p->phase_base[i] = p->phase_ns[i];
+        p->calls_base[i] = p->phase_calls[i];
+    }
+#ifdef __linux__
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        p->perf_base[i] = perf_read(p->perf_fd[i]);
+    }
+    p->nthreads = 0;
+    threads_each(thread_save, p);
+#endif
+    p->wall_ns = clock_ns(CLOCK_MONOTONIC);
+}
+
+void profile_end(struct profile *p, struct profile_report *r)
+{
+    struct rusage ru;
+    double        cpu;
+
+    memset(r, 0, sizeof(*r));
+    r->wall = (clock_ns(CLOCK_MONOTONIC) - p->wall_ns) / 1e9;
+    getrusage(RUSAGE_SELF, &ru);
+    r->user  = (tv_us(ru.ru_utime) - p->user_us) / 1e6;
+    r->sys   = (tv_us(ru.ru_stime) - p->sys_us) / 1e6;
+    r->vcsw  = ru.ru_nvcsw - p->vcsw;
+    r->ivcsw = ru.ru_nivcsw - p->ivcsw;
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        r->phase_cpu[i]   = (p->phase_ns[i] - p->phase_base[i]) / 1e9;
+        r->phase_calls[i] = p->phase_calls[i] - p->calls_base[i];
+    }
+    if (r->wall <= 0) {
+        return;
+    }
+    cpu     = r->user + r->sys;
+    r->util = cpu * 100.0 / (r->wall * p->ncpus);
+
+#ifdef __linux__
+    struct busiest b = { .p = p };
+    threads_each(thread_busiest, &b);
+    r->thread_util = b.ticks * 100.0 / sysconf(_SC_CLK_TCK) / r->wall;
+    memcpy(r->thread, b.name, sizeof(r->thread));
+
+    r->perf        = p->perf_fd[0] >= 0;
+    r->perf_kernel = p->perf_kernel;
+    for (int i = 0; r->perf && i < COUNTER_COUNT; i++) {
+        r->counters[i] = perf_read(p->perf_fd[i]) - p->perf_base[i];
+    }
+#endif
+    r->bench_bound =
+        r->util >= PROFILE_BOUND_PCT || r->thread_util >= PROFILE_BOUND_PCT;
+}
+
+void profile_print(const struct profile_report *r, long messages)
+{
+    static const char *phases[PHASE_COUNT] = { "send", "recv" };
+
+    printf("cpu: user: %.3fs, sys: %.3fs, utilization: %.1f%%", r->user,
+           r->sys, r->util);
+    if (r->thread[0] != '\0') {
+        printf(", busiest thread: %s %.1f%%", r->thread, r->thread_util);
+    }
+    printf(", context switches: %ld/%ld (voluntary/involuntary)\n", r->vcsw,
+           r->ivcsw);
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        if (r->phase_calls[i] == 0) {
+            continue;
+        }
+        printf("cpu in %s callbacks: %.3fs, %.2fus/call", phases[i],
+               r->phase_cpu[i], r->phase_cpu[i] * 1e6 / r->phase_calls[i]);
+        if (messages > 0) {
+            printf(", %.2fus/msg", r->phase_cpu[i] * 1e6 / messages);
+        }
+        printf("\n");
+    }
+    if (r->perf && messages > 0) {
+        printf("perf%s: %.0f cycles/msg, %.0f instructions/msg, ipc: %.2f\n",
+               r->perf_kernel ? "" : " (user only)",
+               (double) r->counters[COUNTER_CYCLES] / messages,
+               (double) r->counters[COUNTER_INSTRUCTIONS] / messages,
+               r->counters[COUNTER_CYCLES] > 0
+                   ? (double) r->counters[COUNTER_INSTRUCTIONS] /
+                       r->counters[COUNTER_CYCLES]
+                   : 0.0);
+    }
+    if (r->bench_bound) {
+        printf("bench-bound: the client was saturated, throughput reflects "
+               "the benchmark rather than the broker\n");
+    }
+}
@@ -0,0 +1,92 @@
+#ifndef MQTT_BENCH_PROFILE_H
+#define MQTT_BENCH_PROFILE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Where the benchmark itself spends CPU, to tell a saturated broker from
+// a saturated client. Process and per-thread CPU time come from
+// getrusage(2) and /proc; cycles and instructions from perf_event_open(2)
+// where the kernel permits it.
+
+// A run counts as bench-bound when the process, or any single thread of
+// it, was busy for at least this share of the wall-clock time.
+#define PROFILE_BOUND_PCT 90.0
+
+enum profile_phase {
+    PHASE_SEND,
+    PHASE_RECV,
+    PHASE_COUNT
+};
+
+enum profile_counter {
+    COUNTER_CYCLES,
+    COUNTER_INSTRUCTIONS,
+    COUNTER_COUNT
+};
+
+struct profile_thread {
+    int      tid;
+    char     name[16];
+    uint64_t ticks; // utime + stime, in clock ticks
+};
+
+struct profile {
+    // Thread CPU time spent in client callbacks, by phase.
+    atomic_ullong phase_ns[PHASE_COUNT];
+    atomic_ullong phase_calls[PHASE_COUNT];
+
+    int    perf_fd[COUNTER_COUNT]; // -1 when unavailable
+    bool   perf_kernel;            // counters include kernel time
+    size_t ncpus;
+
+    // Snapshot taken by profile_begin().
+    uint64_t               wall_ns;
+    uint64_t               user_us;
+    uint64_t               sys_us;
+    long                   vcsw;
+    long                   ivcsw;
+    uint64_t               phase_base[PHASE_COUNT];
+    uint64_t               calls_base[PHASE_COUNT];
+    uint64_t               perf_base[COUNTER_COUNT];
+    struct profile_thread *threads;
+    size_t                 nthreads;
+    size_t                 cap;
+};
+
+struct profile_report {
+    double   wall;        // s
+    double   user;        // s of CPU
+    double   sys;         // s of CPU
+    double   util;        // process CPU over wall time and usable CPUs, %
+    double   thread_util; // busiest thread, %
+    char     thread[16];  // its name
+    long     vcsw;        // voluntary context switches
+    long     ivcsw;       // involuntary context switches
+    double   phase_cpu[PHASE_COUNT]; // s
+    uint64_t phase_calls[PHASE_COUNT];
+    bool     perf;
+    bool     perf_kernel;
+    uint64_t counters[COUNTER_COUNT];
+    bool     bench_bound;
+};
+
+// Counters only follow threads created after profile_init(), so it must
+// run before the first nng socket is opened.
+int      profile_init(struct profile **pp);
+void     profile_fini(struct profile *p);
+void     profile_begin(struct profile *p);
+void     profile_end(struct profile *p, struct profile_report *r);
+void     profile_print(const struct profile_report *r, long messages);
+uint64_t profile_thread_ns(void);
+
+static inline void profile_phase_add(struct profile *p, enum profile_phase ph,
+                                     uint64_t ns)
+{
+    atomic_fetch_add_explicit(&p->phase_ns[ph], ns, memory_order_relaxed);
+    atomic_fetch_add_explicit(&p->phase_calls[ph], 1, memory_order_relaxed);
+}
+
+#endif
@@ -0,0 +1,225 @@
+#include "pub_template.h"
+#include "byteorder.h"
+#include "checksum.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <nng/mqtt/mqtt_client.h>
+
+static size_t digits(uint32_t n)
+{
+    size_t d = 1;
+    while (n >= 10) {
+        n /= 10;
+        d++;
+    }
+    return d;
+}
+
+// With vary > 1 the topic becomes "<topic>/<nnn>", where <nnn> is a
+// zero-padded suffix wide enough for vary - 1 and rewritten per message.
+int pub_template_init(struct pub_template *t, const char *topic, uint8_t qos,
+                      bool retain, const uint8_t *payload, size_t len,
+                      int flags, uint32_t vary, uint32_t id)
+{
+    bool     stamp = (flags & PUB_TEMPLATE_STAMP) != 0;
+    size_t   plen  = len + (stamp ? STAMP_SIZE : 0);
+    uint8_t *pbuf;
+    char *   tbuf;
+    size_t   tlen;
+    uint32_t n;
+    int      rv;
+
+    memset(t, 0, sizeof(*t));
+    t->vary     = vary > 1 ? vary : 1;
+    t->id       = id;
+    t->qos      = qos;
+    t->retain   = retain;
+    t->stamped  = stamp;
+    t->checksum = (flags & PUB_TEMPLATE_CHECKSUM) != 0;
+    if (t->checksum) {
+        plen += CHECKSUM_TRAILER_SIZE;
+    }
+
+    tlen = strlen(topic) + (t->vary > 1 ? 1 + digits(t->vary - 1) : 0);
+    if ((tbuf = nng_alloc(tlen + 1)) == NULL) {
+        return (NNG_ENOMEM);
+    }
+    if (t->vary > 1) {
+        snprintf(tbuf, tlen + 1, "%s/%0*d", topic, (int) digits(t->vary - 1),
+                 0);
+    } else {
+        memcpy(tbuf, topic, tlen + 1);
+    }
+
+    if ((pbuf = nng_alloc(plen > 0 ? plen : 1)) == NULL) {
+        nng_free(tbuf, tlen + 1);
+        return (NNG_ENOMEM);
+    }
+    if (stamp) {
+        memset(pbuf, 0, STAMP_SIZE);
+        put_be32(pbuf, STAMP_MAGIC);
+    }
+    memcpy(pbuf + (stamp ? STAMP_SIZE : 0), payload, len);
+    if (t->checksum) {
+        checksum_seal(pbuf, plen);
+    }
+
+    if ((rv = nng_mqtt_msg_alloc(&t->msg, 0)) != 0) {
+        goto out;
+    }
+    nng_mqtt_msg_set_packet_type(t->msg, NNG_MQTT_PUBLISH);
+    nng_mqtt_msg_set_publish_qos(t->msg, qos);
+    nng_mqtt_msg_set_publish_retain(t->msg, retain);
+    nng_mqtt_msg_set_publish_payload(t->msg, pbuf, (uint32_t) plen);
+    nng_mqtt_msg_set_publish_topic(t->msg, tbuf);
+
+    t->payload     = pbuf;
+    t->payload_len = plen > 0 ? plen : 1;
+    t->topic       = tbuf;
+    t->topic_len   = tlen + 1;
+
+    // Patch whatever buffers the message ended up using, whether it
+    // copied ours or refers to them.
+    t->data     = nng_mqtt_msg_get_publish_payload(t->msg, &n);
+    t->data_len = n;
+    if (stamp) {
+        t->stamp = t->data;
+    }
+    if (t->vary > 1) {
+        t->suffix_len = digits(t->vary - 1);
+        t->suffix =
+            (char *) nng_mqtt_msg_get_publish_topic(t->msg, &n) + n -
+            t->suffix_len;
+    }
+    return (0);
+
+out:
+    nng_free(pbuf, plen > 0 ? plen : 1);
+    nng_free(tbuf, tlen + 1);
+    return (rv);
+}
+
+void pub_template_fini(struct pub_template *t)
+{
+    if (t->msg != NULL) {
+        nng_msg_free(t->msg);
+        t->msg = NULL;
+    }
+    if (t->payload != NULL) {
+        nng_free(t->payload, t->payload_len);
+        t->payload = NULL;
+    }
+    if (t->topic != NULL) {
+        nng_free(t->topic, t->topic_len);
+        t->topic = NULL;
+    }
+    if (t->scratch != NULL) {
+        nng_free(t->scratch, t->scratch_len);
+        t->scratch = NULL;
+    }
+}
+
+static void put_suffix(char *suffix, size_t len, uint32_t v)
+{
+    for (size_t i = len; i > 0; i--) {
+        suffix[i - 1] = (char) ('0' + v % 10);
+        v /= 10;
+    }
+}
+
+static void put_stamp(uint8_t *stamp, uint32_t id, uint64_t seq, uint64_t due)
+{
+    put_be32(stamp + 4, id);
+    put_be64(stamp + 8, seq);
+    put_be64(stamp + 16, due);
+}
+
+// Only one message per template may be in the making at a time; the
+// caller patches and sends, and waits for completion before the next.
+nng_msg *pub_template_next(struct pub_template *t, uint64_t seq, uint64_t due)
+{
+    nng_msg *msg;
+
+    if (t->stamp != NULL) {
+        put_stamp(t->stamp, t->id, seq, due);
+        // The stamp is covered by the checksum, which is otherwise sealed
+        // once when the template is built.
+        if (t->checksum) {
+            checksum_seal(t->data, t->data_len);
+        }
+    }
+    if (t->suffix != NULL) {
+        put_suffix(t->suffix, t->suffix_len, (uint32_t)(seq % t->vary));
+    }
+    if (nng_msg_dup(&msg, t->msg) != 0) {
+        return NULL;
+    }
+    return msg;
+}
+
+// Builds a fresh PUBLISH around a payload that differs per message, such
+// as a corpus record, with the template's topic and options. nng copies
+// the payload into the message, so it is handed over as is unless a
+// stamp or checksum has to be added; then it is assembled in a scratch
+// buffer that is reused, which is safe under the one-at-a-time rule of
+// pub_template_next().
+nng_msg *pub_template_build(struct pub_template *t, uint64_t seq,
+                            uint64_t due, const uint8_t *payload, size_t len)
+{
+    nng_msg *msg;
+    size_t   head = t->stamped ? STAMP_SIZE : 0;
+    size_t   plen = head + len + (t->checksum ? CHECKSUM_TRAILER_SIZE : 0);
+    uint8_t *data = (uint8_t *) payload;
+
+    if (plen != len) {
+        if (plen > t->scratch_len) {
+            uint8_t *scratch;
+            if ((scratch = nng_alloc(plen)) == NULL) {
+                return NULL;
+            }
+            if (t->scratch != NULL) {
+                nng_free(t->scratch, t->scratch_len);
+            }
+            t->scratch     = scratch;
+            t->scratch_len = plen;
+        }
+        data = t->scratch;
+        if (t->stamped) {
+            put_be32(data, STAMP_MAGIC);
+            put_stamp(data, t->id, seq, due);
+        }
+        memcpy(data + head, payload, len);
+        if (t->checksum) {
+            checksum_seal(data, plen);
+        }
+    }
+    if (t->suffix != NULL) {
+        // The topic in t->topic, not the one inside the template message.
+        put_suffix(t->topic + t->topic_len - 1 - t->suffix_len,
+                   t->suffix_len, (uint32_t)(seq % t->vary));
+    }
+
+    if (nng_mqtt_msg_alloc(&msg, 0) != 0) {
+        return NULL;
+    }
+    nng_mqtt_msg_set_packet_type(msg, NNG_MQTT_PUBLISH);
+    nng_mqtt_msg_set_publish_qos(msg, t->qos);
+    nng_mqtt_msg_set_publish_retain(msg, t->retain);
+    nng_mqtt_msg_set_publish_payload(msg, data, (uint32_t) plen);
+    nng_mqtt_msg_set_publish_topic(msg, t->topic);
+    return msg;
+}
+
+bool stamp_parse(const uint8_t *payload, size_t len, struct stamp *s)
+{
+    if (payload == NULL || len < STAMP_SIZE ||
+        get_be32(payload) != STAMP_MAGIC) {
+        return false;
+    }
+    s->id  = get_be32(payload + 4);
+    s->seq = get_be64(payload + 8);
+    s->due = get_be64(payload + 16);
+    return true;
+}
@@ -0,0 +1,61 @@
+#ifndef MQTT_BENCH_PUB_TEMPLATE_H
+#define MQTT_BENCH_PUB_TEMPLATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <nng/nng.h>
+
+// Stamp header prepended to the payload with --stamp. All fields are
+// big-endian; the timestamp is the wall-clock time (us) at which the
+// message was due to be sent.
+#define STAMP_MAGIC 0x6e6d7162 // "nmqb"
+#define STAMP_SIZE 24
+
+// pub_template_init flags.
+#define PUB_TEMPLATE_STAMP 0x1    // prefix the payload with a stamp header
+#define PUB_TEMPLATE_CHECKSUM 0x2 // append a checksum trailer
+
+struct stamp {
+    uint32_t id;  // publishing work
+    uint64_t seq; // per-publisher sequence number
+    uint64_t due; // us since the epoch
+};
+
+// A PUBLISH message built once per work. Sending a message patches the
+// variable bytes (stamp header, checksum trailer and topic suffix) in
+// place and hands a duplicate to nng, instead of building the packet
+// from scratch.
+struct pub_template {
+    nng_msg *msg;
+    uint8_t *payload;
+    size_t   payload_len;
+    char *   topic;
+    size_t   topic_len;
+    uint8_t *data;       // the message's payload
+    size_t   data_len;
+    uint8_t *stamp;      // stamp header within the payload, or NULL
+    bool     checksum;
+    char *   suffix;     // fixed-width decimal topic suffix, or NULL
+    size_t   suffix_len;
+    uint32_t vary;       // number of distinct topic suffixes
+    uint32_t id;
+    uint8_t  qos;
+    bool     retain;
+    bool     stamped;
+    uint8_t *scratch;    // payload assembled by pub_template_build()
+    size_t   scratch_len;
+};
+
+int      pub_template_init(struct pub_template *t, const char *topic,
+                           uint8_t qos, bool retain, const uint8_t *payload,
+                           size_t len, int flags, uint32_t vary, uint32_t id);
+void     pub_template_fini(struct pub_template *t);
+nng_msg *pub_template_next(struct pub_template *t, uint64_t seq, uint64_t due);
+nng_msg *pub_template_build(struct pub_template *t, uint64_t seq,
+                            uint64_t due, const uint8_t *payload, size_t len);
+
+bool stamp_parse(const uint8_t *payload, size_t len, struct stamp *s);
+
+#endif
@@ -0,0 +1,560 @@
+#include "results.h"
+#include "bench.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <nng/nng.h>
+
+void run_result_latency(struct run_result *r, const struct hdr_histogram *h)
+{
+    r->lat_count = hdr_count(h);
+    r->lat_mean  = hdr_mean(h);
+    r->lat_min   = hdr_min(h);
+    r->lat_p50   = hdr_value_at_percentile(h, 50.0);
+    r->lat_p90   = hdr_value_at_percentile(h, 90.0);
+    r->lat_p99   = hdr_value_at_percentile(h, 99.0);
+    r->lat_p999  = hdr_value_at_percentile(h, 99.9);
+    r->lat_max   = hdr_max(h);
+}
+
+double run_metric_value(const struct run_result *r, enum run_metric m)
+{
+    switch (m) {
+    case METRIC_RATE:
+        return r->rate;
+    case METRIC_P50:
+        return r->lat_p50;
+    case METRIC_P99:
+        return r->lat_p99;
+    case METRIC_P999:
+        return r->lat_p999;
+    }
+    return 0;
+}
+
+// Two-sided 95% critical values of Student's t for 1..30 degrees of
+// freedom; beyond that the normal value is close enough.
+static const double t95[] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201,  2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080,  2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+};
+
+double t_critical(double df)
+{
+    size_t i = (size_t) floor(df);
+
+    if (i < 1) {
+        i = 1;
+    }
+    return i <= sizeof(t95) / sizeof(t95[0]) ? t95[i - 1] : 1.960;
+}
+
+void run_stats(const struct run_result *runs, size_t n, enum run_metric m,
+               struct run_stats *st)
+{
+    double sum = 0;
+    double sq  = 0;
+
+    memset(st, 0, sizeof(*st));
+    st->n = n;
+    if (n == 0) {
+        return;
+    }
+    for (size_t i = 0; i < n; i++) {
+        sum += run_metric_value(&runs[i], m);
+    }
+    st->mean = sum / n;
+    if (n < 2) {
+        return;
+    }
+    for (size_t i = 0; i < n; i++) {
+        double d = run_metric_value(&runs[i], m) - st->mean;
+        sq += d * d;
+    }
+    st->sd = sqrt(sq / (n - 1));
+    st->ci = t_critical(n - 1) * st->sd / sqrt(n);
+}
+
+void results_print_aggregate(const struct run_result *runs, size_t n)
+{
+    static const struct {
+        enum run_metric m;
+        const char *    name;
+    } metrics[] = {
+        { METRIC_RATE, "rate(msg/sec)" },
+        { METRIC_P50, "p50(us)" },
+        { METRIC_P99, "p99(us)" },
+        { METRIC_P999, "p99.9(us)" },
+    };
+    struct run_stats st;
+
+    printf("\n%zu runs:\n", n);
+    for (size_t i = 0; i < sizeof(metrics) / sizeof(metrics[0]); i++) {
+        run_stats(runs, n, metrics[i].m, &st);
+        printf("  %-14s mean: %.1f, stddev: %.1f, 95%% ci: +/-%.1f\n",
+               metrics[i].name, st.mean, st.sd, st.ci);
+    }
+}
+
+void results_write(const char *path, const char *type, const char *url,
+                   const struct run_result *runs, size_t n)
+{
+    FILE *f;
+
+    if ((f = fopen(path, "w")) == NULL) {
+        fatal("Cannot open file %s: %s", path, strerror(errno));
+    }
+    fprintf(f, "{\n  \"tool\": \"" APP_NAME "\",\n");
+    fprintf(f, "  \"type\": \"%s\",\n", type);
+    fprintf(f, "  \"url\": \"");
+    for (const char *p = url; *p != '\0'; p++) {
+        if (*p == '"' || *p == '\\') {
+            fputc('\\', f);
+        }
+        fputc(*p, f);
+    }
+    fprintf(f, "\",\n  \"runs\": [");
+    for (size_t i = 0; i < n; i++) {
+        const struct run_result *r = &runs[i];
+        fprintf(f,
+                "%s\n    {\"rate\": %.3f, \"total\": %ld, \"errors\": %ld, "
+                "\"elapsed\": %.6f,\n     \"latency_us\": {\"count\": "
+                "%" PRId64 ", \"mean\": %.3f, \"min\": %" PRId64
+                ", \"p50\": %" PRId64 ", \"p90\": %" PRId64
+                ", \"p99\": %" PRId64 ", \"p999\": %" PRId64
+                ", \"max\": %" PRId64 "}",
+                i > 0 ? "," : "", r->rate, r->total, r->errors, r->elapsed,
+                r->lat_count, r->lat_mean, r->lat_min, r->lat_p50, r->lat_p90,
+                r->lat_p99, r->lat_p999, r->lat_max);
+        if (r->profiled) {
+            fprintf(f,
+                    ",\n     \"cpu\": {\"util\": %.1f, \"thread_util\": %.1f, "
+                    "\"cycles_per_msg\": %.1f, \"bench_bound\": %s}",
+                    r->cpu_util, r->thread_util, r->cycles_per_msg,
+                    r->bench_bound ? "true" : "false");
+        }
+        if (r->conns > 1) {
+            fprintf(f,
+                    ",\n     \"conns\": {\"count\": %zu, \"min\": %.3f, "
+                    "\"median\": %.3f, \"max\": %.3f, \"jain\": %.6f}",
+                    r->conns, r->conn_min, r->conn_median, r->conn_max,
+                    r->jain);
+        }
+        fprintf(f, "}");
+    }
+    fprintf(f, "\n  ]\n}\n");
+    if (fclose(f) != 0) {
+        fatal("Write to %s failed: %s", path, strerror(errno));
+    }
+}
+
+// A small JSON reader, just enough for files written above: it walks the
+// whole document and picks the known fields out of the "runs" array.
+struct json {
+    const char *path;
+    const char *p;
+};
+
+static void json_fail(struct json *j, const char *what)
+{
+    fatal("Malformed result file %s: %s", j->path, what);
+}
+
+static void json_ws(struct json *j)
+{
+    while (isspace((unsigned char) *j->p)) {
+        j->p++;
+    }
+}
+
+static void json_expect(struct json *j, char c)
+{
+    json_ws(j);
+    if (*j->p != c) {
+        json_fail(j, "unexpected character");
+    }
+    j->p++;
+}
+
+// Reads a string into buf (truncated to len - 1); escapes are kept
+// verbatim except for the escaped character itself.
+static void json_string(struct json *j, char *buf, size_t len)
+{
+    size_t n = 0;
+
+    json_expect(j, '"');
+    while (*j->p != '"') {
+        if (*j->p == '\0') {
+            json_fail(j, "unterminated string");
+        }
+        if (*j->p == '\\' && j->p[1] != '\0') {
+            j->p++;
+        }
+        if (n + 1 < len) {
+            buf[n++] = *j->p;
+        }
+        j->p++;
+    }
+    j->p++;
+    buf[n] = '\0';
+}
+
+static double json_number(struct json *j)
+{
+    char * end;
+    double v;
+
+    json_ws(j);
+    v = strtod(j->p, &end);
+    if (end == j->p) {
+        json_fail(j, "number expected");
+    }
+    j->p = end;
+    return v;
+}
+
+static void json_skip(struct json *j);
+
+static void json_skip_container(struct json *j, char open, char close)
+{
+    char key[64];
+
+    json_expect(j, open);
+    json_ws(j);
+    if (*j->p == close) {
+        j->p++;
+        return;
+    }
+    for (;;) {
+        if (open == '{') {
+            json_string(j, key, sizeof(key));
+            json_expect(j, ':');
+        }
+        json_skip(j);
+        json_ws(j);
+        if (*j->p == ',') {
+            j->p++;
+            continue;
+        }
+        json_expect(j, close);
+        return;
+    }
+}
+
+static void json_skip(struct json *j)
+{
+    char buf[8];
+
+    json_ws(j);
+    switch (*j->p) {
+    case '{':
+        json_skip_container(j, '{', '}');
+        break;
+    case '[':
+        json_skip_container(j, '[', ']');
+        break;
+    case '"':
+        json_string(j, buf, sizeof(buf));
+        break;
+    case 't':
+    case 'f':
+    case 'n':
+        while (isalpha((unsigned char) *j->p)) {
+            j->p++;
+        }
+        break;
+    default:
+        json_number(j);
+        break;
+    }
+}
+
+static bool json_bool(struct json *j)
+{
+    json_ws(j);
+    if (strncmp(j->p, "true", 4) == 0) {
+        j->p += 4;
+        return true;
+    }
+    if (strncmp(j->p, "false", 5) == 0) {
+        j->p += 5;
+        return false;
+    }
+    json_fail(j, "boolean expected");
+    return false;
+}
+
+static void json_cpu(struct json *j, struct run_result *r)
+{
+    char key[64];
+
+    r->profiled = true;
+    json_expect(j, '{');
+    json_ws(j);
+    if (*j->p == '}') {
+        j->p++;
+        return;
+    }
+    for (;;) {
+        json_string(j, key, sizeof(key));
+        json_expect(j, ':');
+        if (strcmp(key, "util") == 0) {
+            r->cpu_util = json_number(j);
+        } else if (strcmp(key, "thread_util") == 0) {
+            r->thread_util = json_number(j);
+        } else if (strcmp(key, "cycles_per_msg") == 0) {
+            r->cycles_per_msg = json_number(j);
+        } else if (strcmp(key, "bench_bound") == 0) {
+            r->bench_bound = json_bool(j);
+        } else {
+            json_skip(j);
+        }
+        json_ws(j);
+        if (*j->p == ',') {
+            j->p++;
+            continue;
+        }
+        json_expect(j, '}');
+        return;
+    }
+}
+
+static void json_conns(struct json *j, struct run_result *r)
+{
+    char key[64];
+
+    json_expect(j, '{');
+    json_ws(j);
+    if (*j->p == '}') {
+        j->p++;
+        return;
+    }
+    for (;;) {
+        json_string(j, key, sizeof(key));
+        json_expect(j, ':');
+        if (strcmp(key, "count") == 0) {
+            r->conns = (size_t) json_number(j);
+        } else if (strcmp(key, "min") == 0) {
+            r->conn_min = json_number(j);
+        } else if (strcmp(key, "median") == 0) {
+            r->conn_median = json_number(j);
+        } else if (strcmp(key, "max") == 0) {
+            r->conn_max = json_number(j);
+        } else if (strcmp(key, "jain") == 0) {
+            r->jain = json_number(j);
+        } else {
+            json_skip(j);
+        }
+        json_ws(j);
+        if (*j->p == ',') {
+            j->p++;
+            continue;
+        }
+        json_expect(j, '}');
+        return;
+    }
+}
+
+static void json_latency(struct json *j, struct run_result *r)
+{
+    char key[64];
+
+    json_expect(j, '{');
+    json_ws(j);
+    if (*j->p == '}') {
+        j->p++;
+        return;
+    }
+    for (;;) {
+        json_string(j, key, sizeof(key));
+        json_expect(j, ':');
+        if (strcmp(key, "count") == 0) {
+            r->lat_count = (int64_t) json_number(j);
+        } else if (strcmp(key, "mean") == 0) {
+            r->lat_mean = json_number(j);
+        } else if (strcmp(key, "min") == 0) {
+            r->lat_min = (int64_t) json_number(j);
+        } else if (strcmp(key, "p50") == 0) {
+            r->lat_p50 = (int64_t) json_number(j);
+        } else if (strcmp(key, "p90") == 0) {
+            r->lat_p90 = (int64_t) json_number(j);
+        } else if (strcmp(key, "p99") == 0) {
+            r->lat_p99 = (int64_t) json_number(j);
+        } else if (strcmp(key, "p999") == 0) {
+            r->lat_p999 = (int64_t) json_number(j);
+        } else if (strcmp(key, "max") == 0) {
+            r->lat_max = (int64_t) json_number(j);
+        } else {
+            json_skip(j);
+        }
+        json_ws(j);
+        if (*j->p == ',') {
+            j->p++;
+            continue;
+        }
+        json_expect(j, '}');
+        return;
+    }
+}
+
+static void json_run(struct json *j, struct run_result *r)
+{
+    char key[64];
+
+    memset(r, 0, sizeof(*r));
+    json_expect(j, '{');
+    json_ws(j);
+    if (*j->p == '}') {
+        j->p++;
+        return;
+    }
+    for (;;) {
+        json_string(j, key, sizeof(key));
+        json_expect(j, ':');
+        if (strcmp(key, "rate") == 0) {
+            r->rate = json_number(j);
+        } else if (strcmp(key, "total") == 0) {
+            r->total = (long) json_number(j);
+        } else if (strcmp(key, "errors") == 0) {
+            r->errors = (long) json_number(j);
+        } else if (strcmp(key, "elapsed") == 0) {
+            r->elapsed = json_number(j);
+        } else if (strcmp(key, "latency_us") == 0) {
+            json_latency(j, r);
+        } else if (strcmp(key, "cpu") == 0) {
+            json_cpu(j, r);
+        } else if (strcmp(key, "conns") == 0) {
+            json_conns(j, r);
+        } else {
+            json_skip(j);
+        }
+        json_ws(j);
+        if (*j->p == ',') {
+            j->p++;
+            continue;
+        }
+        json_expect(j, '}');
+        return;
+    }
+}
+
+static void json_runs(struct json *j, struct run_result **runsp, size_t *np)
+{
+    size_t cap = 0;
+
+    json_expect(j, '[');
+    json_ws(j);
+    if (*j->p == ']') {
+        j->p++;
+        return;
+    }
+    for (;;) {
+        if (*np == cap) {
+            struct run_result *runs;
+            size_t             ncap = cap == 0 ? 8 : cap * 2;
+            if ((runs = nng_alloc(sizeof(*runs) * ncap)) == NULL) {
+                fatal("Out of memory.");
+            }
+            if (*runsp != NULL) {
+                memcpy(runs, *runsp, sizeof(*runs) * *np);
+                nng_free(*runsp, sizeof(*runs) * cap);
+            }
+            *runsp = runs;
+            cap    = ncap;
+        }
+        json_run(j, &(*runsp)[(*np)++]);
+        json_ws(j);
+        if (*j->p == ',') {
+            j->p++;
+            continue;
+        }
+        json_expect(j, ']');
+        break;
+    }
+    if (*np < cap) {
+        struct run_result *runs;
+        if ((runs = nng_alloc(sizeof(*runs) * *np)) == NULL) {
+            fatal("Out of memory.");
+        }
+        memcpy(runs, *runsp, sizeof(*runs) * *np);
+        nng_free(*runsp, sizeof(*runs) * cap);
+        *runsp = runs;
+    }
+}
+
+void results_load(const char *path, char *url, size_t url_len,
+                  struct run_result **runsp, size_t *np)
+{
+    FILE *      f;
+    char *      data;
+    long        len = 0;
+    struct json j;
+    char        key[64];
+
+    if ((f = fopen(path, "rb")) == NULL) {
+        fatal("Cannot open file %s: %s", path, strerror(errno));
+    }
+    if (fseek(f, 0, SEEK_END) != 0) {
+        fatal("Read from %s failed: %s", path, strerror(errno));
+    }
+    len = ftell(f);
+    if (len < 0 || fseek(f, 0, SEEK_SET) != 0) {
+        fatal("Read from %s failed: %s", path, strerror(errno));
+    }
+    if ((data = malloc(len + 1)) == NULL) {
+        fatal("Out of memory.");
+    }
+    if (fread(data, 1, len, f) != (size_t) len) {
+        fatal("Read from %s failed: %s", path, strerror(errno));
+    }
+    fclose(f);
+    data[len] = '\0';
+
+    *runsp = NULL;
+    *np    = 0;
+    if (url != NULL) {
+        url[0] = '\0';
+    }
+    j.path = path;
+    j.p    = data;
+
+    json_expect(&j, '{');
+    json_ws(&j);
+    while (*j.p != '}') {
+        json_string(&j, key, sizeof(key));
+        json_expect(&j, ':');
+        if (strcmp(key, "runs") == 0) {
+            json_runs(&j, runsp, np);
+        } else if (strcmp(key, "url") == 0 && url != NULL) {
+            json_string(&j, url, url_len);
+        } else {
+            json_skip(&j);
+        }
+        json_ws(&j);
+        if (*j.p == ',') {
+            j.p++;
+            json_ws(&j);
+        } else if (*j.p != '}') {
+            json_fail(&j, "',' or '}' expected");
+        }
+    }
+    free(data);
+
+    if (*np == 0) {
+        fatal("Result file %s has no runs.", path);
+    }
+}
+
+void results_free(struct run_result *runs, size_t n)
+{
+    if (runs != NULL) {
+        nng_free(runs, sizeof(*runs) * n);
+    }
+}
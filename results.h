@@ -0,0 +1,65 @@
+#ifndef MQTT_BENCH_RESULTS_H
+#define MQTT_BENCH_RESULTS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "hdr_histogram.h"
+
+// Outcome of one measured run, as written to and read from --json files.
+struct run_result {
+    double  rate;    // msg/sec over the wall-clock time of the run
+    long    total;   // messages sent or received
+    long    errors;  // failed sends
+    double  elapsed; // seconds
+    int64_t lat_count;
+    double  lat_mean; // latencies are in microseconds
+    int64_t lat_min;
+    int64_t lat_p50;
+    int64_t lat_p90;
+    int64_t lat_p99;
+    int64_t lat_p999;
+    int64_t lat_max;
+    bool    profiled; // the fields below are only set with --profile
+    double  cpu_util;    // % of the usable CPUs
+    double  thread_util; // % of the busiest thread
+    double  cycles_per_msg;
+    bool    bench_bound;
+    size_t  conns; // the fields below are only set with --conns > 1
+    double  conn_min;    // msg/sec of the least served connection
+    double  conn_median;
+    double  conn_max;
+    double  jain; // Jain's fairness index across connections
+};
+
+enum run_metric {
+    METRIC_RATE,
+    METRIC_P50,
+    METRIC_P99,
+    METRIC_P999,
+};
+
+struct run_stats {
+    size_t n;
+    double mean;
+    double sd;
+    double ci; // half width of the 95% confidence interval of the mean
+};
+
+void   run_result_latency(struct run_result *r, const struct hdr_histogram *h);
+double run_metric_value(const struct run_result *r, enum run_metric m);
+void   run_stats(const struct run_result *runs, size_t n, enum run_metric m,
+                 struct run_stats *st);
+double t_critical(double df);
+void   results_print_aggregate(const struct run_result *runs, size_t n);
+
+// Like loadfile(), these report I/O and format errors through fatal().
+void results_write(const char *path, const char *type, const char *url,
+                   const struct run_result *runs, size_t n);
+// url, when not NULL, receives the broker url of the runs.
+void results_load(const char *path, char *url, size_t url_len,
+                  struct run_result **runsp, size_t *np);
+void results_free(struct run_result *runs, size_t n);
+
+#endif